@@ -44,7 +44,7 @@ p4_table:
 p3_table:
     resb 4096
 p2_table:
-    resb 4096
+    resb 4096 * 4  ; One P2 per GB of the 4GB identity map
 
 ; Kernel stack (16KB)
 stack_bottom:
@@ -78,24 +78,34 @@ _start:
     ; Set up page tables
     call setup_page_tables
 
-    ; Enable PAE (Physical Address Extension)
+    ; Enable PAE (Physical Address Extension) and PGE (global pages, used
+    ; by the kernel mappings VirtualAllocator builds)
     mov eax, cr4
-    or eax, 1 << 5
+    or eax, (1 << 5) | (1 << 7)
     mov cr4, eax
 
     ; Load P4 table into CR3
     mov eax, p4_table
     mov cr3, eax
 
-    ; Enable long mode in EFER MSR
+    ; Enable long mode in EFER MSR, and NXE when the CPU has the NX bit
+    ; (the kernel maps its data no-execute)
+    mov eax, 0x80000001
+    cpuid
+    mov ebx, edx
     mov ecx, 0xC0000080
     rdmsr
     or eax, 1 << 8  ; Set LME (Long Mode Enable)
+    test ebx, 1 << 20
+    jz .efer_ready
+    or eax, 1 << 11 ; Set NXE (No-Execute Enable)
+.efer_ready:
     wrmsr
 
     ; Enable paging and protected mode
     mov eax, cr0
     or eax, 1 << 31  ; Set PG (paging)
+    or eax, 1 << 16  ; Set WP (kernel writes fault on read-only pages, for COW)
     or eax, 1 << 0   ; Set PE (protected mode)
     mov cr0, eax
 
@@ -167,26 +177,41 @@ setup_page_tables:
     or eax, PAGE_PRESENT | PAGE_WRITE
     mov [p4_table + 511 * 8], eax
 
-    ; Map P3[0] -> P2 (for both identity and higher-half)
-    mov eax, p2_table
+    ; Map P4[256] -> P3 (physmap alias of the first 4GB at 0xFFFF800000000000)
+    mov eax, p3_table
     or eax, PAGE_PRESENT | PAGE_WRITE
-    mov [p3_table], eax
+    mov [p4_table + 256 * 8], eax
+
+    ; Map P3[0..3] -> P2 tables (identity map the first 4GB so ACPI tables
+    ; and the frame database are reachable before paging is rebuilt)
+    mov ecx, 0
+.map_p3:
+    mov eax, ecx
+    shl eax, 12
+    add eax, p2_table
+    or eax, PAGE_PRESENT | PAGE_WRITE
+    mov [p3_table + ecx * 8], eax
+
+    inc ecx
+    cmp ecx, 4
+    jne .map_p3
 
     ; Also map P3[510] -> P2 for higher-half
     mov eax, p2_table
     or eax, PAGE_PRESENT | PAGE_WRITE
     mov [p3_table + 510 * 8], eax
 
-    ; Map first 2MB with huge pages (P2[0])
+    ; Map the first 4GB with 2MB huge pages
     mov ecx, 0
 .map_p2:
     mov eax, 0x200000  ; 2MB page size
-    mul ecx
+    mul ecx            ; edx:eax = physical address
     or eax, PAGE_PRESENT | PAGE_WRITE | PAGE_HUGE
     mov [p2_table + ecx * 8], eax
+    mov [p2_table + ecx * 8 + 4], edx
 
     inc ecx
-    cmp ecx, 512  ; 512 entries = 1GB
+    cmp ecx, 2048  ; 4 tables x 512 entries = 4GB
     jne .map_p2
 
     ret
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <tiny_os/common/types.h>
+
+namespace tiny_os::arch::x86_64 {
+
+// Root System Description Pointer (ACPI 2.0+ layout)
+struct AcpiRsdp {
+    char signature[8];      // "RSD PTR "
+    uint8 checksum;
+    char oem_id[6];
+    uint8 revision;         // 0 = ACPI 1.0 (RSDT only), 2+ = XSDT available
+    uint32 rsdt_address;
+    uint32 length;
+    uint64 xsdt_address;
+    uint8 extended_checksum;
+    uint8 reserved[3];
+} __attribute__((packed));
+
+// Common header of every System Description Table
+struct AcpiSdtHeader {
+    char signature[4];
+    uint32 length;
+    uint8 revision;
+    uint8 checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32 oem_revision;
+    uint32 creator_id;
+    uint32 creator_revision;
+} __attribute__((packed));
+
+// Memory range owned by a NUMA node (from an SRAT memory affinity entry)
+struct NumaMemoryRange {
+    PhysicalAddress base;
+    uint64 length;
+    uint32 node;
+};
+
+// ACPI table discovery and NUMA topology (SRAT/SLIT)
+class ACPI {
+public:
+    static constexpr usize MAX_NUMA_NODES = 8;
+    static constexpr usize MAX_MEMORY_RANGES = 32;
+    static constexpr usize MAX_APIC_IDS = 256;
+
+    // SLIT distances used when the firmware provides no SLIT
+    static constexpr uint8 LOCAL_DISTANCE = 10;
+    static constexpr uint8 REMOTE_DISTANCE = 20;
+
+    // Locate the RSDT/XSDT through the Multiboot2 RSDP tag and parse the
+    // SRAT and SLIT. Must run after Multiboot2::parse; tables are read
+    // through the physmap, which boot.asm sets up for the first 4GB.
+    static void init();
+
+    // Find a table by its 4-character signature (nullptr if absent)
+    static const AcpiSdtHeader* find_table(const char* signature);
+
+    // NUMA topology; a machine without an SRAT is a single node 0
+    static usize numa_node_count();
+    static usize memory_range_count();
+    static const NumaMemoryRange& memory_range(usize index);
+    static usize node_for_apic(uint32 apic_id);
+    static uint8 node_distance(usize from, usize to);
+
+private:
+    static const AcpiSdtHeader* rsdt_;
+    static bool xsdt_;
+
+    static usize node_count_;
+    static uint32 node_domains_[MAX_NUMA_NODES];    // Proximity domain per node
+    static NumaMemoryRange memory_ranges_[MAX_MEMORY_RANGES];
+    static usize memory_range_count_;
+    static uint8 apic_nodes_[MAX_APIC_IDS];
+    static uint8 distances_[MAX_NUMA_NODES][MAX_NUMA_NODES];
+
+    static bool checksum_ok(const void* data, usize length);
+    static usize node_for_domain(uint32 domain);
+    static void parse_srat(const AcpiSdtHeader* srat);
+    static void parse_slit(const AcpiSdtHeader* slit);
+};
+
+} // namespace tiny_os::arch::x86_64
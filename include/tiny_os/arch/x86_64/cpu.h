@@ -0,0 +1,71 @@
+#pragma once
+
+#include <tiny_os/common/types.h>
+
+namespace tiny_os::arch::x86_64 {
+
+class CPU {
+public:
+    // Upper bound for per-CPU data arrays
+    static constexpr usize MAX_CPUS = 16;
+
+    // Index of the executing CPU (0 = bootstrap processor).
+    // Only the BSP runs until SMP bring-up exists.
+    static usize current_index() { return 0; }
+
+    static void cpuid(uint32 leaf, uint32 subleaf,
+                      uint32& eax, uint32& ebx, uint32& ecx, uint32& edx) {
+        asm volatile("cpuid"
+                     : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                     : "a"(leaf), "c"(subleaf));
+    }
+
+    // Initial local APIC ID of the executing CPU (CPUID leaf 1)
+    static uint32 apic_id() {
+        uint32 eax, ebx, ecx, edx;
+        cpuid(1, 0, eax, ebx, ecx, edx);
+        return ebx >> 24;
+    }
+
+    // 1GB pages are supported (CPUID 0x80000001 EDX.Page1GB)
+    static bool has_1gb_pages() {
+        uint32 eax, ebx, ecx, edx;
+        cpuid(0x80000001, 0, eax, ebx, ecx, edx);
+        return (edx & (1U << 26)) != 0;
+    }
+
+    // No-execute page protection (CPUID 0x80000001 EDX.NX)
+    static bool has_nx() {
+        uint32 eax, ebx, ecx, edx;
+        cpuid(0x80000001, 0, eax, ebx, ecx, edx);
+        return (edx & (1U << 20)) != 0;
+    }
+
+    // Process-context identifiers (CPUID 1 ECX.PCID)
+    static bool has_pcid() {
+        uint32 eax, ebx, ecx, edx;
+        cpuid(1, 0, eax, ebx, ecx, edx);
+        return (ecx & (1U << 17)) != 0;
+    }
+
+    // INVPCID instruction (CPUID 7 EBX.INVPCID)
+    static bool has_invpcid() {
+        uint32 eax, ebx, ecx, edx;
+        cpuid(0, 0, eax, ebx, ecx, edx);
+        if (eax < 7) return false;
+        cpuid(7, 0, eax, ebx, ecx, edx);
+        return (ebx & (1U << 10)) != 0;
+    }
+
+    static uint64 read_cr4() {
+        uint64 value;
+        asm volatile("mov %%cr4, %0" : "=r"(value));
+        return value;
+    }
+
+    static void write_cr4(uint64 value) {
+        asm volatile("mov %0, %%cr4" : : "r"(value) : "memory");
+    }
+};
+
+} // namespace tiny_os::arch::x86_64
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <tiny_os/common/types.h>
+
+namespace tiny_os {
+
+// Links embedded in an object that lives in an AvlTree
+struct AvlNode {
+    AvlNode* left = nullptr;
+    AvlNode* right = nullptr;
+    AvlNode* parent = nullptr;
+    int32 height = 1;
+};
+
+// Default augment hook: no derived per-node data
+struct AvlNoAugment {
+    template <typename T>
+    void operator()(T*, const T*, const T*) const {}
+};
+
+// Intrusive AVL tree.
+//
+// T embeds an AvlNode at member Link and Less orders two Ts. The tree never
+// allocates: objects are linked and unlinked in place, so one object can
+// sit in several trees at once through several AvlNode members.
+//
+// Augment(item, left, right) is called whenever a node's subtree changes
+// (left and right are its children or nullptr), so T can keep data derived
+// from its subtree, such as a maximum, up to date through rotations.
+template <typename T, AvlNode T::*Link, typename Less, typename Augment = AvlNoAugment>
+class AvlTree {
+public:
+    bool empty() const { return root_ == nullptr; }
+
+    T* first() const { return owner(leftmost(root_)); }
+    T* last() const { return owner(rightmost(root_)); }
+
+    // Raw structure, for searches guided by augmented data
+    T* root() const { return owner(root_); }
+    static T* left(T* item) { return owner((item->*Link).left); }
+    static T* right(T* item) { return owner((item->*Link).right); }
+
+    static T* next(T* item) {
+        AvlNode* node = &(item->*Link);
+        if (node->right) return owner(leftmost(node->right));
+
+        while (node->parent && node->parent->right == node) {
+            node = node->parent;
+        }
+        return owner(node->parent);
+    }
+
+    static T* prev(T* item) {
+        AvlNode* node = &(item->*Link);
+        if (node->left) return owner(rightmost(node->left));
+
+        while (node->parent && node->parent->left == node) {
+            node = node->parent;
+        }
+        return owner(node->parent);
+    }
+
+    // First item for which at_or_after(item) is true. The predicate must be
+    // monotone in tree order (false for a prefix, true for the rest).
+    template <typename Pred>
+    T* search(Pred at_or_after) const {
+        AvlNode* node = root_;
+        AvlNode* result = nullptr;
+
+        while (node) {
+            if (at_or_after(owner(node))) {
+                result = node;
+                node = node->left;
+            } else {
+                node = node->right;
+            }
+        }
+        return owner(result);
+    }
+
+    void insert(T* item) {
+        AvlNode* node = &(item->*Link);
+        AvlNode* parent = nullptr;
+        AvlNode** link = &root_;
+
+        while (*link) {
+            parent = *link;
+            link = Less()(*item, *owner(parent)) ? &parent->left : &parent->right;
+        }
+
+        node->left = nullptr;
+        node->right = nullptr;
+        node->parent = parent;
+        node->height = 1;
+        *link = node;
+
+        rebalance(node);
+    }
+
+    void erase(T* item) {
+        AvlNode* node = &(item->*Link);
+        AvlNode* rebalance_from;
+
+        if (node->left && node->right) {
+            // The successor takes the node's place in the tree
+            AvlNode* successor = leftmost(node->right);
+
+            if (successor->parent == node) {
+                rebalance_from = successor;
+            } else {
+                rebalance_from = successor->parent;
+                successor->parent->left = successor->right;
+                if (successor->right) successor->right->parent = successor->parent;
+                successor->right = node->right;
+                node->right->parent = successor;
+            }
+
+            successor->left = node->left;
+            node->left->parent = successor;
+            successor->parent = node->parent;
+            successor->height = node->height;
+            replace_child(node->parent, node, successor);
+        } else {
+            AvlNode* child = node->left ? node->left : node->right;
+            if (child) child->parent = node->parent;
+            replace_child(node->parent, node, child);
+            rebalance_from = node->parent;
+        }
+
+        rebalance(rebalance_from);
+    }
+
+    // Recompute the augmented data of item and its ancestors after a field
+    // the hook reads has changed in place
+    void refresh(T* item) {
+        for (AvlNode* node = &(item->*Link); node; node = node->parent) {
+            update(node);
+        }
+    }
+
+    // Unlink everything, handing each item to dispose bottom-up (children
+    // before their parent) without rebalancing
+    template <typename Dispose>
+    void clear(Dispose dispose) {
+        AvlNode* node = root_;
+        while (node) {
+            if (node->left) {
+                node = node->left;
+            } else if (node->right) {
+                node = node->right;
+            } else {
+                AvlNode* parent = node->parent;
+                if (parent) {
+                    if (parent->left == node) parent->left = nullptr;
+                    else parent->right = nullptr;
+                }
+                dispose(owner(node));
+                node = parent;
+            }
+        }
+        root_ = nullptr;
+    }
+
+private:
+    AvlNode* root_ = nullptr;
+
+    static T* owner(AvlNode* node) {
+        if (!node) return nullptr;
+        usize offset = reinterpret_cast<usize>(&(static_cast<T*>(nullptr)->*Link));
+        return reinterpret_cast<T*>(reinterpret_cast<uint8*>(node) - offset);
+    }
+
+    static AvlNode* leftmost(AvlNode* node) {
+        while (node && node->left) node = node->left;
+        return node;
+    }
+
+    static AvlNode* rightmost(AvlNode* node) {
+        while (node && node->right) node = node->right;
+        return node;
+    }
+
+    static int32 height(const AvlNode* node) {
+        return node ? node->height : 0;
+    }
+
+    static void update(AvlNode* node) {
+        int32 left = height(node->left);
+        int32 right = height(node->right);
+        node->height = 1 + (left > right ? left : right);
+        Augment()(owner(node), owner(node->left), owner(node->right));
+    }
+
+    void replace_child(AvlNode* parent, AvlNode* old_child, AvlNode* new_child) {
+        if (!parent) {
+            root_ = new_child;
+        } else if (parent->left == old_child) {
+            parent->left = new_child;
+        } else {
+            parent->right = new_child;
+        }
+    }
+
+    AvlNode* rotate_left(AvlNode* node) {
+        AvlNode* pivot = node->right;
+
+        node->right = pivot->left;
+        if (pivot->left) pivot->left->parent = node;
+
+        pivot->parent = node->parent;
+        replace_child(node->parent, node, pivot);
+
+        pivot->left = node;
+        node->parent = pivot;
+
+        update(node);
+        update(pivot);
+        return pivot;
+    }
+
+    AvlNode* rotate_right(AvlNode* node) {
+        AvlNode* pivot = node->left;
+
+        node->left = pivot->right;
+        if (pivot->right) pivot->right->parent = node;
+
+        pivot->parent = node->parent;
+        replace_child(node->parent, node, pivot);
+
+        pivot->right = node;
+        node->parent = pivot;
+
+        update(node);
+        update(pivot);
+        return pivot;
+    }
+
+    // Walk to the root fixing heights and balance
+    void rebalance(AvlNode* node) {
+        while (node) {
+            update(node);
+            int32 balance = height(node->left) - height(node->right);
+
+            if (balance > 1) {
+                if (height(node->left->left) < height(node->left->right)) {
+                    rotate_left(node->left);
+                }
+                node = rotate_right(node);
+            } else if (balance < -1) {
+                if (height(node->right->right) < height(node->right->left)) {
+                    rotate_right(node->right);
+                }
+                node = rotate_left(node);
+            }
+
+            node = node->parent;
+        }
+    }
+};
+
+} // namespace tiny_os
@@ -61,6 +61,14 @@ struct MultibootMmapEntry {
     uint32 reserved;
 } __attribute__((packed));
 
+// Boot module tag; a NUL-terminated command line follows
+struct MultibootTagModule {
+    uint32 type;
+    uint32 size;
+    uint32 mod_start;
+    uint32 mod_end;
+} __attribute__((packed));
+
 // Basic memory info tag
 struct MultibootTagBasicMeminfo {
     uint32 type;
@@ -73,7 +81,13 @@ class Multiboot2 {
 public:
     static void parse(void* multiboot_info);
 
-    static const MultibootTag* find_tag(MultibootTagType type);
+    // First tag of `type`, or the next one after `after`
+    static const MultibootTag* find_tag(MultibootTagType type,
+                                        const MultibootTag* after = nullptr);
+
+    // Whether the kernel command line contains `option` as a whole
+    // space-separated word
+    static bool has_option(const char* option);
     static void print_memory_map();
 
     static uint64 get_total_memory();
@@ -26,6 +26,8 @@ using VirtualAddress = uint64;
 // Page-related constants
 constexpr usize PAGE_SIZE = 4096;
 constexpr usize PAGE_SHIFT = 12;
+constexpr usize PAGE_SIZE_2M = 2ULL * 1024 * 1024;     // PD-level huge page
+constexpr usize PAGE_SIZE_1G = 1024ULL * 1024 * 1024;  // PDPT-level huge page
 
 // Alignment macros
 constexpr VirtualAddress page_align_down(VirtualAddress addr) {
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <tiny_os/common/types.h>
+#include <tiny_os/memory/page_table.h>
+#include <tiny_os/memory/pcid.h>
+
+namespace tiny_os::memory {
+
+// User part of a process address space. PML4[0] stays shared with the
+// kernel: the low identity map (VGA text buffer, boot stack) lives there.
+constexpr VirtualAddress USER_SPACE_START = 0x0000008000000000ULL;
+constexpr VirtualAddress USER_SPACE_END = 0x0000800000000000ULL;
+
+// Per-process page tables.
+//
+// Every address space shares the kernel's PML4 entries; only the user part
+// is private. clone() gives a child copy-on-write access to the parent's
+// pages: writable PTEs are made read-only and marked COPY_ON_WRITE in both
+// tables and the frames gain a reference, so a fork copies page tables but
+// no data. The first write to such a page faults and gets a private copy,
+// or takes the page over when no one else maps it anymore.
+class AddressSpace {
+public:
+    // New address space with an empty user part
+    static PageTable* create();
+
+    // Copy-on-write clone of parent's user part. The parent's TLB must be
+    // flushed afterwards (flush_tlb), as its writable pages became read-only.
+    static PageTable* clone(PageTable* parent);
+
+    // Drop every user page and page table. Must not be the live address space.
+    static void destroy(PageTable* pml4);
+
+    // Map a 4KB user page; false if something is mapped there already
+    static bool map_page(PageTable* pml4, VirtualAddress virt, PhysicalAddress phys,
+                         uint64 flags);
+
+    // Unmap the user pages in [start, end), dropping their frame references,
+    // and flush them from the TLB: page by page under the space's PCID when
+    // at most TlbBatch::MAX_PAGES were mapped, otherwise the whole context.
+    static void unmap_range(PageTable* pml4, PcidTag& tag,
+                            VirtualAddress start, VirtualAddress end);
+
+    // Physical address behind a user address (0 if unmapped)
+    static PhysicalAddress virt_to_phys(PageTable* pml4, VirtualAddress virt);
+
+    // Resolve a write fault on a copy-on-write page of the live address
+    // space; false if virt is not copy-on-write
+    static bool handle_write_fault(VirtualAddress virt);
+
+    // Flush the TLB entries cached for an address space
+    static void flush_tlb(PageTable* pml4, PcidTag& tag);
+
+    // Page table loaded in CR3
+    static PageTable* current();
+
+    static void print_stats();
+
+private:
+    static constexpr usize USER_PML4_FIRST = 1;
+    static constexpr usize USER_PML4_END = 256;
+
+    static uint64 cow_faults_;
+    static uint64 cow_copies_;
+
+    // Share the leaf pages of one PT copy-on-write; returns the child's PT
+    static PhysicalAddress clone_table(PageTable* parent, usize level);
+
+    static void destroy_table(PhysicalAddress table_phys, usize level);
+
+    // Leaf entry for virt, or nullptr if a table on the way is missing
+    static PageTableEntry* find_entry(PageTable* pml4, VirtualAddress virt);
+};
+
+} // namespace tiny_os::memory
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <tiny_os/common/types.h>
+
+namespace tiny_os::memory {
+
+// Run of pages an arena bumps through; the header sits at its start
+struct ArenaChunk {
+    ArenaChunk* next;       // Older chunk of the same arena, or next pooled chunk
+    usize size;             // Bytes, header included
+};
+
+// Bump allocator for short-lived scratch memory.
+//
+// Allocation advances an offset in the newest chunk; nothing is freed
+// individually. mark() records the current position and reset() rolls back
+// to it, handing chunks taken since then back to a shared pool. Chunks of
+// CHUNK_SIZE are recycled through the pool, so a steady workload never
+// touches the heap or the physical allocator.
+//
+// An arena is used by one thread at a time. Arena::scratch() is the
+// calling thread's own; pair it with ArenaScope so every path releases
+// what it took.
+class Arena {
+public:
+    static constexpr usize CHUNK_SIZE = 64 * 1024;
+    static constexpr usize POOL_LIMIT = 16;     // Idle chunks kept (1MB)
+
+    struct Mark {
+        ArenaChunk* chunk;
+        usize offset;
+    };
+
+    constexpr Arena() = default;
+    ~Arena() { reset(Mark{nullptr, 0}); }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Allocate size bytes aligned to align (a power of two up to PAGE_SIZE)
+    void* alloc(usize size, usize align = 16);
+
+    template <typename T>
+    T* alloc_array(usize count) {
+        return static_cast<T*>(alloc(count * sizeof(T), alignof(T)));
+    }
+
+    Mark mark() const { return Mark{chunk_, offset_}; }
+
+    // Release everything allocated since the mark
+    void reset(Mark mark);
+
+    // Scratch arena of the running thread (a boot arena before the first
+    // thread runs)
+    static Arena& scratch();
+
+    static void print_stats();
+
+private:
+    ArenaChunk* chunk_ = nullptr;   // Newest chunk
+    usize offset_ = 0;              // Next free byte in chunk_
+
+    static ArenaChunk* pool_;
+    static usize pooled_;
+    static uint64 chunk_allocs_;    // Chunks taken from PhysicalAllocator
+    static uint64 pool_hits_;
+
+    static ArenaChunk* get_chunk(usize size);
+    static void put_chunk(ArenaChunk* chunk);
+};
+
+// Releases everything allocated from an arena during a scope
+class ArenaScope {
+public:
+    explicit ArenaScope(Arena& arena = Arena::scratch())
+        : arena_(arena), mark_(arena.mark()) {}
+    ~ArenaScope() { arena_.reset(mark_); }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+    void* alloc(usize size, usize align = 16) { return arena_.alloc(size, align); }
+
+    template <typename T>
+    T* alloc_array(usize count) { return arena_.alloc_array<T>(count); }
+
+private:
+    Arena& arena_;
+    Arena::Mark mark_;
+};
+
+} // namespace tiny_os::memory
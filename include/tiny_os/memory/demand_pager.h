@@ -0,0 +1,51 @@
+#pragma once
+
+#include <tiny_os/common/types.h>
+#include <tiny_os/memory/page_table.h>
+
+namespace tiny_os::arch::x86_64 {
+struct InterruptFrame;
+}
+
+namespace tiny_os::memory {
+
+// Page fault error code bits
+namespace PageFaultError {
+    constexpr uint64 PRESENT = 1ULL << 0;   // Protection violation (page was present)
+    constexpr uint64 WRITE = 1ULL << 1;     // Write access
+    constexpr uint64 USER = 1ULL << 2;      // Fault in user mode
+    constexpr uint64 RESERVED = 1ULL << 3;  // Reserved bit set in a paging entry
+    constexpr uint64 FETCH = 1ULL << 4;     // Instruction fetch
+}
+
+// Demand paging for process memory.
+//
+// A not-present fault inside a VMA of the current process is resolved by
+// mapping a zeroed frame. Fault-around populates the other missing pages
+// of the aligned FAULT_AROUND_PAGES window in the same fault, so
+// sequential access takes one fault per window instead of one per page.
+// Kernel memory is always mapped up front.
+class DemandPager {
+public:
+    static constexpr usize FAULT_AROUND_PAGES = 16;     // 64KB window
+
+    // Install the page fault handler (vector 14); IDT::init must have run
+    static void init();
+
+    // Resolve a fault at addr: a missing page of a VMA or a write to a
+    // copy-on-write page. False if it is neither.
+    static bool handle_fault(VirtualAddress addr, uint64 error_code);
+
+    static void print_stats();
+
+private:
+    static uint64 faults_;
+    static uint64 pages_populated_;
+
+    static void page_fault_handler(arch::x86_64::InterruptFrame* frame);
+
+    // Map a zeroed frame at virt in pml4
+    static void populate(PageTable* pml4, VirtualAddress virt, uint64 flags);
+};
+
+} // namespace tiny_os::memory
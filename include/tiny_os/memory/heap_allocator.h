@@ -4,19 +4,46 @@
 
 namespace tiny_os::memory {
 
-// Heap block header (placed before each allocated block)
+// Heap block header (placed before each block's payload).
+//
+// Blocks tile the heap in address order. A free block also keeps its
+// free-list links at the start of the payload and a copy of its size in its
+// last word (boundary tag), so the block after it can find its start.
 struct HeapBlockHeader {
-    usize size;              // Size including header
-    bool is_free;
-    HeapBlockHeader* next;
+    usize size;              // Size including header; low bits are flags
     uint32 magic;            // Magic number for corruption detection
+    uint32 profile;          // HeapProfiler call-site tag and birth tick
+
+    // Free blocks only (overlay the payload)
+    HeapBlockHeader* next_free;
+    HeapBlockHeader* prev_free;
 
     static constexpr uint32 MAGIC_VALUE = 0xDEADBEEF;
-} __attribute__((packed));
 
+    static constexpr usize FREE = 1ULL << 0;        // This block is free
+    static constexpr usize PREV_FREE = 1ULL << 1;   // The block before is free
+    static constexpr usize FLAG_MASK = 0xF;
+};
+
+// Two-level segregated fit (TLSF) kernel heap.
+//
+// Free blocks sit in segregated lists indexed by a first level (power of
+// two) and a second level (16 linear steps within it). Two bitmaps record
+// which lists are non-empty, so finding a fitting block takes two bit scans
+// and merging with physical neighbours uses the boundary tags: kmalloc and
+// kfree run in constant time however fragmented the heap is.
+//
+// The heap owns a reserved virtual range but maps it in 2MB chunks as it
+// grows. When the free block at the end spans TRIM_THRESHOLD bytes beyond
+// a spare chunk, kfree unmaps the excess and returns its frames.
 class HeapAllocator {
 public:
-    static void init(VirtualAddress start, usize size);
+    static constexpr usize CHUNK_SIZE = PAGE_SIZE_2M;
+    static constexpr usize TRIM_THRESHOLD = 2 * CHUNK_SIZE;
+
+    // Take over the virtual range [start, start + max_size), which must be
+    // 2MB aligned, and map its first chunk
+    static void init(VirtualAddress start, usize max_size);
 
     // Allocate memory
     static void* kmalloc(usize size);
@@ -24,32 +51,101 @@ public:
     // Free memory
     static void kfree(void* ptr);
 
-    // Allocate aligned memory
+    // Allocate memory at a power-of-two alignment. The block itself is
+    // placed at the alignment (the skipped prefix is split off as a free
+    // block), so the result is released with kfree like any other.
     static void* kmalloc_aligned(usize size, usize alignment);
 
-    // Statistics
+    // kmalloc (alignment 0) or kmalloc_aligned on behalf of `caller`, so
+    // wrappers such as operator new charge the profiler to their caller
+    static void* kmalloc_from(const void* caller, usize size, usize alignment = 0);
+
+    // Whether ptr points into the heap (early boot allocations do not)
+    static bool contains(const void* ptr);
+
+    // Statistics (total_size is the mapped part of the heap)
     static usize total_size();
+    static usize reserved_size();
     static usize used_size();
     static usize free_size();
 
-    static void print_stats();
+    // Largest block kmalloc could return right now
+    static usize largest_free_block();
 
-    // Merge adjacent free blocks
-    static void merge_free_blocks();
+    static void print_stats();
 
 private:
-    static HeapBlockHeader* free_list_head_;
+    static constexpr usize ALIGNMENT = 16;
+    static constexpr usize HEADER_SIZE = 16;    // size + magic; links are payload
+
+    // Header, free-list links and boundary tag
+    static constexpr usize MIN_BLOCK_SIZE = 48;
+
+    // Second level: 16 lists per power of two
+    static constexpr usize SL_INDEX_COUNT_LOG2 = 4;
+    static constexpr usize SL_INDEX_COUNT = 1ULL << SL_INDEX_COUNT_LOG2;
+
+    // Blocks below 256 bytes share first level 0 in 16-byte steps
+    static constexpr usize FL_INDEX_SHIFT = SL_INDEX_COUNT_LOG2 + 4;
+    static constexpr usize SMALL_BLOCK_SIZE = 1ULL << FL_INDEX_SHIFT;
+
+    // Blocks are smaller than 2^FL_INDEX_MAX bytes
+    static constexpr usize FL_INDEX_MAX = 40;
+    static constexpr usize FL_INDEX_COUNT = FL_INDEX_MAX - FL_INDEX_SHIFT + 1;
+    static constexpr usize MAX_ALLOC_SIZE = 1ULL << (FL_INDEX_MAX - 2);
+
+    static uint64 fl_bitmap_;
+    static uint32 sl_bitmap_[FL_INDEX_COUNT];
+    static HeapBlockHeader* free_lists_[FL_INDEX_COUNT][SL_INDEX_COUNT];
+
     static VirtualAddress heap_start_;
-    static usize heap_size_;
+    static VirtualAddress heap_end_;        // End of the mapped part
+    static VirtualAddress heap_limit_;      // End of the reserved range
     static usize used_bytes_;
 
-    static constexpr usize MIN_BLOCK_SIZE = sizeof(HeapBlockHeader) + 16;
+    // Size class of a block size; search rounds up so any block in the
+    // returned list fits
+    static void mapping_insert(usize size, usize& fl, usize& sl);
+    static void mapping_search(usize size, usize& fl, usize& sl);
+
+    // Non-empty list at (fl, sl) or the next larger one
+    static HeapBlockHeader* find_suitable_block(usize& fl, usize& sl);
+
+    // Take a free block of at least `size` bytes off its list
+    static HeapBlockHeader* locate_free_block(usize size);
+
+    static void insert_free_block(HeapBlockHeader* block);
+    static void remove_free_block(HeapBlockHeader* block);
+
+    // Carve a used block of `size` bytes out of a free block that is not on
+    // any list, returning the remainder to the lists
+    static void* use_block(HeapBlockHeader* block, usize size);
+
+    // Split off the front of a free block (not on any list) so that its
+    // payload lands on `alignment`; returns the aligned block
+    static HeapBlockHeader* align_block(HeapBlockHeader* block, usize alignment);
+
+    // Physical neighbours
+    static HeapBlockHeader* next_block(HeapBlockHeader* block);
+    static HeapBlockHeader* prev_block(HeapBlockHeader* block);
+
+    // Turn a block into a free block, writing its boundary tag and telling
+    // the next block
+    static void mark_free(HeapBlockHeader* block, usize size);
+
+    // Merge a used block with its free neighbours and put the result on
+    // its list
+    static HeapBlockHeader* release_block(HeapBlockHeader* block);
+
+    // Map enough chunks after the end of the heap for a `size` byte block
+    static bool grow(usize size);
 
-    // Find suitable free block (first-fit)
-    static HeapBlockHeader* find_free_block(usize size);
+    // Give back the chunks past the free last block
+    static void trim(HeapBlockHeader* block);
 
-    // Split block if it's too large
-    static void split_block(HeapBlockHeader* block, usize size);
+    // Back and map, or unmap and free, whole chunks
+    static bool map_chunks(VirtualAddress start, usize length);
+    static void unmap_chunks(VirtualAddress start, usize length);
 };
 
 } // namespace tiny_os::memory
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <tiny_os/common/types.h>
+
+namespace tiny_os::memory {
+
+struct HeapBlockHeader;
+
+// Heap usage charged to one allocating call site
+struct HeapCallSite {
+    static constexpr usize SIZE_CLASSES = 16;   // Powers of two from 32 bytes
+
+    const void* caller;         // Return address into the allocating code
+    uint64 allocs;
+    uint64 frees;
+    usize live_bytes;           // Block sizes, headers included
+    usize peak_bytes;
+    uint64 lifetime_ticks;      // Summed over freed blocks
+    uint64 max_lifetime_ticks;
+    uint32 size_classes[SIZE_CLASSES];   // Requested sizes
+};
+
+// Optional heap allocation profiler.
+//
+// While enabled, every kmalloc is charged to its caller's return address:
+// allocation counts, a histogram of requested sizes, live and peak bytes
+// (whole blocks), and the lifetime of blocks when they are freed. The
+// call-site tag and birth tick live in the block header, so tracking needs
+// no memory of its own beyond the fixed site table. Blocks allocated while
+// disabled are not tracked.
+class HeapProfiler {
+public:
+    // Site tags are 8 bits and 0 means untracked; the last site collects
+    // callers that no longer fit in the table
+    static constexpr usize MAX_SITES = 255;
+
+    static void enable();
+    static void disable();
+    static bool enabled() { return enabled_; }
+
+    // Called by HeapAllocator with interrupts disabled. requested is the
+    // caller's size, size the block's (header and rounding included).
+    static void record_alloc(HeapBlockHeader* block, usize requested, usize size,
+                             const void* caller);
+    static void record_free(HeapBlockHeader* block, usize size);
+
+    // Per-site text report and heap fragmentation over serial, busiest
+    // sites (by peak bytes) first
+    static void report();
+
+private:
+    static constexpr usize OVERFLOW_SITE = MAX_SITES - 1;
+    static constexpr uint32 TAG_MASK = 0xFF;
+    static constexpr usize BIRTH_SHIFT = 8;     // Birth tick in the upper 24 bits
+    static constexpr uint32 BIRTH_MASK = 0xFFFFFF;
+
+    static bool enabled_;
+    static HeapCallSite sites_[MAX_SITES];
+    static usize site_count_;
+    static uint64 allocs_;
+    static uint64 frees_;
+    static usize live_bytes_;
+    static usize peak_bytes_;
+
+    // Index of the caller's site, adding it if needed
+    static usize site_for(const void* caller);
+};
+
+} // namespace tiny_os::memory
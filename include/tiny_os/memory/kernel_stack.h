@@ -0,0 +1,64 @@
+#pragma once
+
+#include <tiny_os/common/types.h>
+#include <tiny_os/arch/x86_64/cpu.h>
+
+namespace tiny_os::memory {
+
+// Idle stacks kept mapped for one CPU
+struct StackCache {
+    static constexpr usize SIZE = 16;
+
+    usize count;
+    VirtualAddress stacks[SIZE];    // Bottoms of cached stacks
+    uint64 hits;
+    uint64 misses;
+};
+
+// Kernel thread stacks.
+//
+// Stacks live in fixed slots of a range reserved from Vmalloc: each slot is
+// an unmapped guard page followed by STACK_SIZE bytes of stack, so running
+// off the bottom of a stack faults instead of overwriting its neighbour.
+// Slots are backed when first handed out. A freed stack goes to the CPU's
+// cache still mapped, so the next thread created there takes it without
+// touching the frame allocator or the page tables; only when the cache is
+// full is it unmapped and its slot released.
+//
+// Stack pages are mapped up front rather than on first touch: without IST
+// stacks, a fault on a missing stack page would push its exception frame
+// onto that same page.
+class KernelStack {
+public:
+    static constexpr usize STACK_SIZE = 16 * 1024;
+    static constexpr usize GUARD_SIZE = PAGE_SIZE;
+    static constexpr usize SLOT_SIZE = STACK_SIZE + GUARD_SIZE;
+    static constexpr usize MAX_STACKS = 65536;      // 1.25GB of address space
+
+    // Reserve the stack region; Vmalloc::init must have run
+    static void init();
+
+    // Bottom of a mapped stack, or 0 when every slot is taken
+    static VirtualAddress allocate();
+
+    // Give back a stack nobody runs on any more
+    static void free(VirtualAddress bottom);
+
+    static void print_stats();
+
+private:
+    static VirtualAddress base_;
+    static uint64 slots_[MAX_STACKS / 64];     // Bit set: slot in use or cached
+    static usize cursor_;                       // Word the next search starts at
+    static usize mapped_;                       // Slots backed by frames
+    static usize in_use_;
+    static StackCache caches_[arch::x86_64::CPU::MAX_CPUS];
+
+    // Claim a free slot and back it
+    static VirtualAddress map_slot();
+
+    // Unmap a stack and release its slot
+    static void unmap_slot(VirtualAddress bottom);
+};
+
+} // namespace tiny_os::memory
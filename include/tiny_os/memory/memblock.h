@@ -0,0 +1,74 @@
+#pragma once
+
+#include <tiny_os/common/types.h>
+
+namespace tiny_os::memory {
+
+// Physical range [base, base + size)
+struct MemblockRegion {
+    PhysicalAddress base;
+    usize size;
+};
+
+// Sorted, non-overlapping ranges; touching ranges are merged
+struct MemblockType {
+    static constexpr usize MAX_REGIONS = 128;
+
+    MemblockRegion regions[MAX_REGIONS];
+    usize count;
+};
+
+// Early boot allocator over the Multiboot2 memory map.
+//
+// Memblock knows which physical memory is usable and which parts of it are
+// reserved: the low 1MB, the kernel image, the Multiboot2 information, boot
+// modules and anything allocated from it. It serves page-granular
+// allocations before the frame allocator exists, top-down from the part of
+// memory the boot page tables reach. PhysicalAllocator::init places the
+// frame database with it and then takes over every range left free; from
+// then on memblock allocations panic.
+class Memblock {
+public:
+    // Memory the boot page tables alias at the physmap base
+    static constexpr PhysicalAddress BOOT_MAPPED_LIMIT = 0x100000000ULL;
+
+    // Record usable memory from the memory map and reserve what the kernel
+    // and the bootloader occupy
+    static void init(void* multiboot_info);
+
+    // Reserve [base, base + size), rounded out to whole pages
+    static void reserve(PhysicalAddress base, usize size);
+
+    // Drop a reservation (rounded out to whole pages)
+    static void free(PhysicalAddress base, usize size);
+
+    // Reserve size bytes (rounded up to whole pages) at a power-of-two
+    // alignment of at least a page; panics when nothing fits
+    static PhysicalAddress alloc(usize size, usize alignment = PAGE_SIZE);
+
+    // Pass every usable, unreserved range to `release` (page aligned,
+    // ascending) and retire
+    static void hand_over(void (*release)(PhysicalAddress start, PhysicalAddress end));
+
+    static bool active() { return active_; }
+
+    // Usable memory: total bytes and the end of the highest range
+    static usize memory_size();
+    static PhysicalAddress memory_end();
+
+    static void print_regions();
+
+private:
+    static MemblockType memory_;
+    static MemblockType reserved_;
+    static bool active_;
+
+    static void add_range(MemblockType& type, PhysicalAddress base, PhysicalAddress end);
+    static void remove_range(MemblockType& type, PhysicalAddress base, PhysicalAddress end);
+
+    // Call fn(start, end) for each usable range not covered by a reservation
+    template <typename Fn>
+    static void for_each_free_range(Fn fn);
+};
+
+} // namespace tiny_os::memory
@@ -15,6 +15,7 @@ namespace PageFlags {
     constexpr uint64 DIRTY = 1ULL << 6;
     constexpr uint64 HUGE_PAGE = 1ULL << 7;
     constexpr uint64 GLOBAL = 1ULL << 8;
+    constexpr uint64 COPY_ON_WRITE = 1ULL << 9;    // Software bit: shared until written
     constexpr uint64 NO_EXECUTE = 1ULL << 63;
 }
 
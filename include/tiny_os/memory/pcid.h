@@ -0,0 +1,65 @@
+#pragma once
+
+#include <tiny_os/common/types.h>
+
+namespace tiny_os::memory {
+
+// PCID of an address space. The tag is only valid while its generation
+// matches the allocator's; a stale tag gets a fresh PCID on the next switch.
+struct PcidTag {
+    uint16 pcid = 0;
+    uint64 generation = 0;
+};
+
+// Process-context identifier allocator.
+//
+// With CR4.PCIDE set the TLB tags every entry with the PCID in CR3[11:0],
+// and loading CR3 with bit 63 set keeps the cached translations of all
+// other address spaces. PCIDs are handed out in sequence; once all of them
+// are used the generation is bumped and the whole TLB is flushed once,
+// which retires every tag handed out before. PCID 0 is the kernel's.
+//
+// Single CPU only: with SMP the counters and tags become per-CPU.
+class Pcid {
+public:
+    static constexpr uint16 KERNEL = 0;
+    static constexpr usize COUNT = 4096;
+    static constexpr uint64 CR3_NOFLUSH = 1ULL << 63;
+
+    // Enable CR4.PCIDE if the CPU supports it. CR3 must hold PCID 0.
+    static void init();
+
+    static bool enabled();
+
+    // CR3 value that loads pml4_phys under tag's PCID without flushing,
+    // assigning a new PCID first if the tag is stale
+    static uint64 cr3_for(PhysicalAddress pml4_phys, PcidTag& tag);
+
+    // Drop the translation of virt cached for an address space. Uses invlpg
+    // when the space is live, INVPCID otherwise, and falls back to retiring
+    // the tag when INVPCID is missing.
+    static void invalidate_page(PcidTag& tag, VirtualAddress virt);
+
+    // Drop every non-global translation cached for an address space:
+    // a CR3 reload when it is live, INVPCID otherwise, retiring the tag
+    // when INVPCID is missing
+    static void invalidate_context(PcidTag& tag);
+
+    // Flush every TLB entry of every PCID, global ones included
+    static void invalidate_all();
+
+    static void print_stats();
+
+private:
+    static bool enabled_;
+    static bool invpcid_;
+    static uint16 next_pcid_;
+    static uint64 generation_;
+    static uint64 rollovers_;
+
+    static uint64 read_cr3();
+    static uint16 current_pcid();
+    static void invpcid(uint64 type, uint16 pcid, VirtualAddress virt);
+};
+
+} // namespace tiny_os::memory
@@ -1,50 +1,236 @@
 #pragma once
 
 #include <tiny_os/common/types.h>
+#include <tiny_os/arch/x86_64/cpu.h>
+#include <tiny_os/arch/x86_64/acpi.h>
 
 namespace tiny_os::memory {
 
+// Largest buddy block is 2^BUDDY_MAX_ORDER frames (1GB, one huge page)
+constexpr usize BUDDY_MAX_ORDER = 18;
+
+// Zones per NUMA node (DMA, DMA32, Normal)
+constexpr usize MEMORY_ZONE_COUNT = 3;
+
+// Allocation flags restricting which zones may satisfy a request
+namespace AllocFlags {
+    constexpr uint32 NONE = 0;
+    constexpr uint32 DMA = 1U << 0;     // Below 16MB (ISA DMA)
+    constexpr uint32 DMA32 = 1U << 1;   // Below 4GB (32-bit DMA)
+}
+
+// Free block bitmap for one buddy order.
+//
+// Bit i of words is set when block (base + i) is free. Two summary levels sit
+// on top: summary has one bit per non-empty word and groups one bit per
+// non-empty summary word, so the next free block is found with a handful of
+// __builtin_ctzll calls no matter how fragmented memory is.
+struct FreeArea {
+    uint64* words;
+    uint64* summary;
+    uint64* groups;
+    usize base;             // First block index covered
+    usize word_count;
+    usize summary_count;
+    usize group_count;
+    usize cursor;           // Next-fit start position (block index)
+    usize free_blocks;
+
+    void set(usize block);
+    void clear(usize block);
+    bool test(usize block) const;
+
+    // First free block at or after `from`, or INVALID if there is none
+    usize find_next(usize from) const;
+
+    // Next-fit search starting at the cursor, wrapping around once
+    usize find();
+
+    static constexpr usize INVALID = static_cast<usize>(-1);
+};
+
+// Physical memory zone with its own buddy free areas.
+// Blocks never cross a zone boundary.
+struct MemoryZone {
+    const char* name;
+    usize start_frame;
+    usize end_frame;
+    usize managed_frames;   // Usable frames handed to the buddy allocator
+    FreeArea free_area[BUDDY_MAX_ORDER + 1];
+
+    usize free_frames() const;
+};
+
+// NUMA node: a contiguous span of physical memory split into zones.
+// Node spans partition the frame database, so every frame has one owner.
+struct MemoryNode {
+    usize start_frame;
+    usize end_frame;
+    MemoryZone zones[MEMORY_ZONE_COUNT];
+
+    // All nodes ordered by distance from this one, this node first
+    usize fallback[arch::x86_64::ACPI::MAX_NUMA_NODES];
+
+    usize managed_frames() const;
+    usize free_frames() const;
+};
+
+// Per-CPU cache of free frames in front of the buddy allocator.
+//
+// Single-frame allocations and frees are served from the magazine without
+// touching the buddy free areas. An empty magazine is refilled up to the low
+// watermark in one batch; once it reaches the high watermark it is drained
+// back down to the low watermark.
+struct FrameMagazine {
+    static constexpr usize CAPACITY = 64;
+    static constexpr usize LOW_WATERMARK = 16;
+    static constexpr usize HIGH_WATERMARK = 48;
+
+    PhysicalAddress frames[CAPACITY];
+    usize count;
+
+    // Counters (misses are refills and drains)
+    uint64 allocs;
+    uint64 frees;
+    uint64 refills;
+    uint64 drains;
+};
+
+// Buddy-system physical frame allocator.
+//
+// Memory is managed in blocks of 2^order contiguous frames. Each zone of each
+// NUMA node keeps a FreeArea bitmap of free blocks per order; allocation splits the smallest
+// free block that fits and freeing coalesces a block with its buddy, so both
+// take O(MAX_ORDER) steps. A per-frame allocation bitmap is kept alongside
+// for double-free detection and statistics; a frame's bit is set only while
+// a caller owns it, so frames cached in magazines have it clear.
+//
+// Allocations come from the calling CPU's node and fall back to the other
+// nodes in order of SLIT distance.
 class PhysicalAllocator {
 public:
-    static void init(void* multiboot_info);
+    static constexpr usize MAX_ORDER = BUDDY_MAX_ORDER;
+
+    // Zones, lowest first
+    static constexpr usize ZONE_DMA = 0;
+    static constexpr usize ZONE_DMA32 = 1;
+    static constexpr usize ZONE_NORMAL = 2;
+    static constexpr usize ZONE_COUNT = MEMORY_ZONE_COUNT;
+
+    static constexpr usize MAX_NODES = arch::x86_64::ACPI::MAX_NUMA_NODES;
+
+    // Take over the memory Memblock has not reserved
+    static void init();
 
     // Allocate a 4KB physical frame
-    static PhysicalAddress allocate_frame();
+    static PhysicalAddress allocate_frame(uint32 flags = AllocFlags::NONE);
 
     // Free a 4KB physical frame
     static void free_frame(PhysicalAddress addr);
 
-    // Allocate multiple contiguous frames
-    static PhysicalAddress allocate_frames(usize count);
+    // Allocate multiple contiguous frames. Up to 2^MAX_ORDER frames, the
+    // block is aligned to count rounded up to a power of two, so 512 and
+    // 262144 frames give 2MB- and 1GB-aligned blocks for huge pages.
+    static PhysicalAddress allocate_frames(usize count, uint32 flags = AllocFlags::NONE);
+
+    // Allocate contiguous frames, preferring the given NUMA node
+    static PhysicalAddress allocate_frames_on(usize node, usize count,
+                                              uint32 flags = AllocFlags::NONE);
+
+    // Like allocate_frames, but returns 0 instead of panicking when no
+    // block is available
+    static PhysicalAddress try_allocate_frames(usize count, uint32 flags = AllocFlags::NONE);
 
     // Free multiple contiguous frames
     static void free_frames(PhysicalAddress addr, usize count);
 
+    // Reference counts for frames mapped more than once (copy-on-write).
+    // A freshly allocated frame has one reference; unref_frame frees the
+    // frame when the last one is dropped and returns true.
+    static void ref_frame(PhysicalAddress addr);
+    static bool unref_frame(PhysicalAddress addr);
+    static usize frame_refs(PhysicalAddress addr);
+
+    // Live entries of a page-table frame, kept by VirtualAllocator so it
+    // can free tables that become empty
+    static uint16& table_entries(PhysicalAddress table) {
+        return table_entries_[table / FRAME_SIZE];
+    }
+
     // Statistics
     static usize total_frames();
     static usize used_frames();
     static usize free_frames();
+    static usize cached_frames();
+
+    // NUMA topology
+    static usize node_count();
+    static usize current_node();
+    static usize node_of(PhysicalAddress addr);
+
+    // End of the highest usable physical memory
+    static PhysicalAddress memory_end();
 
     static void print_stats();
 
 private:
     static constexpr usize FRAME_SIZE = 4096;
-    static constexpr usize BITMAP_ENTRIES_PER_UINT32 = 32;
+    static constexpr usize BITMAP_ENTRIES_PER_UINT64 = 64;
+    static constexpr usize INVALID_FRAME = static_cast<usize>(-1);
 
-    static uint32* bitmap_;
-    static usize bitmap_size_;  // In uint32s
-    static usize total_frames_;
+    static constexpr PhysicalAddress DMA_LIMIT = 16ULL * 1024 * 1024;
+    static constexpr PhysicalAddress DMA32_LIMIT = 0x100000000ULL;
+
+    static uint64* bitmap_;
+    static usize bitmap_size_;  // In uint64s
+    static uint16* extra_refs_; // References beyond the first, per frame
+    static uint16* table_entries_;  // Present entries, per page-table frame
+    static usize frame_count_;  // Frames covered by the frame database
+    static usize total_frames_; // Usable frames
     static usize used_frames_;
     static PhysicalAddress memory_end_;
 
+    static MemoryNode nodes_[MAX_NODES];
+    static usize node_count_;
+    static usize cpu_nodes_[arch::x86_64::CPU::MAX_CPUS];
+    static FrameMagazine magazines_[arch::x86_64::CPU::MAX_CPUS];
+
     // Kernel end symbol (defined in linker script)
     static uint8 kernel_end;
 
     static void set_frame(usize frame_index);
     static void clear_frame(usize frame_index);
     static bool test_frame(usize frame_index);
-    static usize find_free_frame();
-    static usize find_free_frames(usize count);
+    static void mark_frames(usize first_frame, usize count, bool used);
+
+    // Node and zone helpers
+    static void setup_nodes();
+    static uint64* setup_node(MemoryNode& node, uint64* storage);
+    static uint64* setup_zone(MemoryZone& zone, const char* name,
+                              usize start_frame, usize end_frame, uint64* storage);
+    // Free-area bitmap words setup_zone takes for [start_frame, end_frame)
+    static usize zone_words(usize start_frame, usize end_frame);
+    static MemoryNode& node_for(usize frame_index);
+    static MemoryZone& zone_for(usize frame_index);
+    static usize highest_zone(uint32 flags);
+    static PhysicalAddress try_allocate_frames_on(usize node, usize count, uint32 flags);
+
+    // Buddy operations (frame indices)
+    static usize order_for(usize count);
+    static usize allocate_block(usize order, uint32 flags, usize node);
+    static usize allocate_block(MemoryZone& zone, usize order);
+    static void free_block(MemoryZone& zone, usize frame_index, usize order);
+    static void free_range(usize first_frame, usize count);
+    static void claim_range(usize first_frame, usize count);
+
+    // Move frames between a magazine and the buddy allocator
+    static void refill_magazine(FrameMagazine& magazine);
+    static void drain_magazine(FrameMagazine& magazine);
+
+    // Fallback for requests larger than the biggest buddy block
+    static usize find_free_frames(usize count, usize limit_frame);
+    // Whether the frame lies in a block of its zone's free areas
+    static bool in_free_block(usize frame_index);
 };
 
 } // namespace tiny_os::memory
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <tiny_os/common/types.h>
+#include <tiny_os/memory/virtual_allocator.h>
+
+namespace tiny_os::memory {
+
+// Direct map of all physical memory (PML4 entries 256+).
+// boot.asm aliases the first 4GB here; VirtualAllocator::init maps the rest.
+constexpr VirtualAddress PHYSMAP_BASE = 0xFFFF800000000000ULL;
+constexpr usize PHYSMAP_MAX_SIZE = 64ULL * 1024 * 1024 * 1024 * 1024;  // 64TB
+
+// Higher-half kernel image base (matches linker.ld)
+constexpr VirtualAddress KERNEL_VIRTUAL_BASE = 0xFFFFFFFF80000000ULL;
+
+// Kernel half of the address space, shared by every address space and
+// mapped global
+inline bool is_kernel_address(VirtualAddress virt) {
+    return virt >= PHYSMAP_BASE;
+}
+
+// Kernel pointer to a physical address
+template <typename T = void>
+inline T* phys_to_virt(PhysicalAddress phys) {
+    return reinterpret_cast<T*>(phys + PHYSMAP_BASE);
+}
+
+// Physical address behind a kernel pointer. Physmap and kernel image
+// addresses are translated arithmetically; anything else takes a page walk.
+inline PhysicalAddress virt_to_phys(const void* ptr) {
+    VirtualAddress virt = reinterpret_cast<VirtualAddress>(ptr);
+
+    if (virt >= KERNEL_VIRTUAL_BASE) {
+        return virt - KERNEL_VIRTUAL_BASE;
+    }
+    if (virt >= PHYSMAP_BASE && virt - PHYSMAP_BASE < PHYSMAP_MAX_SIZE) {
+        return virt - PHYSMAP_BASE;
+    }
+    return VirtualAllocator::virt_to_phys(virt);
+}
+
+} // namespace tiny_os::memory
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <tiny_os/common/types.h>
+#include <tiny_os/arch/x86_64/cpu.h>
+#include <new>
+
+namespace tiny_os::memory {
+
+class KmemCache;
+
+// Header at the start of every slab, followed by its objects. Slabs are
+// naturally aligned, so an object finds its slab by masking its address.
+struct Slab {
+    KmemCache* cache;
+    Slab* prev;             // Partial list links
+    Slab* next;
+    void* free_list;        // Free objects, linked through their first word
+    usize in_use;
+};
+
+// Per-CPU stack of free objects in front of a cache's slabs
+struct ObjectMagazine {
+    static constexpr usize CAPACITY = 16;
+    static constexpr usize BATCH = 8;       // Objects moved per refill/drain
+
+    void* objects[CAPACITY];
+    usize count;
+};
+
+// Object cache for one fixed-size kernel type (kmem_cache style).
+//
+// Objects are carved out of slabs of 1-8 physically contiguous pages
+// reached through the physmap. The only per-object overhead is the
+// rounding to the alignment; each slab spends a few dozen bytes on its
+// header. Allocation and free take a per-CPU magazine in the common case
+// and move BATCH objects between the magazine and the slabs otherwise,
+// all in O(1).
+//
+// The constructor only does constant initialization, so caches can be
+// globals in a kernel that runs no static constructors. An optional ctor
+// runs once per object when its slab is created; objects must be freed in
+// constructed state, so the free-list link then gets a word of its own
+// after the object instead of overlaying its first word.
+class KmemCache {
+public:
+    static constexpr usize CACHE_LINE = 64;
+    static constexpr usize MAX_SLAB_PAGES = 8;
+    static constexpr usize MIN_OBJECTS_PER_SLAB = 8;
+
+    constexpr KmemCache(const char* name, usize object_size, usize align = 8,
+                        void (*ctor)(void*) = nullptr)
+        : name_(name),
+          link_offset_(ctor ? round_up(object_size, alignof(void*)) : 0),
+          object_size_(round_up(link_offset_ + sizeof(void*) > object_size
+                                    ? link_offset_ + sizeof(void*)
+                                    : object_size,
+                                align)),
+          align_(align),
+          ctor_(ctor),
+          slab_pages_(pages_for(object_size_, header_size(align))),
+          first_offset_(header_size(align)),
+          objects_per_slab_((slab_pages_ * PAGE_SIZE - first_offset_) / object_size_) {}
+
+    KmemCache(const KmemCache&) = delete;
+    KmemCache& operator=(const KmemCache&) = delete;
+
+    void* alloc();
+    void free(void* object);
+
+    const char* name() const { return name_; }
+    usize object_size() const { return object_size_; }
+
+    // Statistics of every cache used so far
+    static void print_stats();
+
+private:
+    const char* name_;
+    usize link_offset_;         // Free-list link position inside an object
+    usize object_size_;         // Stride, link and alignment included
+    usize align_;
+    void (*ctor_)(void*);
+    usize slab_pages_;
+    usize first_offset_;
+    usize objects_per_slab_;
+
+    Slab* partial_ = nullptr;   // Slabs with free objects
+    Slab* empty_ = nullptr;     // One fully free slab kept for reuse
+    usize slab_count_ = 0;
+    usize objects_in_use_ = 0;  // Held by callers or magazines
+    uint64 allocs_ = 0;
+    uint64 frees_ = 0;
+    uint64 magazine_misses_ = 0;
+    KmemCache* next_cache_ = nullptr;
+    bool registered_ = false;
+
+    ObjectMagazine magazines_[arch::x86_64::CPU::MAX_CPUS] = {};
+
+    static KmemCache* caches_;
+
+    static constexpr usize round_up(usize value, usize align) {
+        return (value + align - 1) & ~(align - 1);
+    }
+
+    static constexpr usize header_size(usize align) {
+        return round_up(sizeof(Slab), align);
+    }
+
+    // Smallest power-of-two slab holding MIN_OBJECTS_PER_SLAB objects
+    static constexpr usize pages_for(usize object_size, usize header) {
+        usize pages = 1;
+        while (pages < MAX_SLAB_PAGES &&
+               (pages * PAGE_SIZE - header) / object_size < MIN_OBJECTS_PER_SLAB) {
+            pages *= 2;
+        }
+        return pages;
+    }
+
+    void*& link(void* object) const {
+        return *reinterpret_cast<void**>(static_cast<uint8*>(object) + link_offset_);
+    }
+
+    Slab* slab_of(void* object) const {
+        return reinterpret_cast<Slab*>(reinterpret_cast<VirtualAddress>(object) &
+                                       ~(slab_pages_ * PAGE_SIZE - 1));
+    }
+
+    Slab* grow();
+    void release_slab(Slab* slab);
+    void link_partial(Slab* slab);
+    void unlink_partial(Slab* slab);
+
+    // Move objects between a magazine and the slabs
+    void refill(ObjectMagazine& magazine);
+    void drain(ObjectMagazine& magazine);
+    void free_to_slab(void* object);
+};
+
+// Typed front end: objects are value-initialized on allocation and
+// destroyed on free, like new/delete
+template <typename T>
+class ObjectCache {
+public:
+    constexpr explicit ObjectCache(const char* name, usize align = alignof(T))
+        : cache_(name, sizeof(T), align < alignof(T) ? alignof(T) : align) {}
+
+    T* alloc() {
+        void* memory = cache_.alloc();
+        return memory ? new (memory) T() : nullptr;
+    }
+
+    void free(T* object) {
+        if (!object) return;
+        object->~T();
+        cache_.free(object);
+    }
+
+    KmemCache& cache() { return cache_; }
+
+private:
+    KmemCache cache_;
+};
+
+} // namespace tiny_os::memory
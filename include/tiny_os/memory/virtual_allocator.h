@@ -2,9 +2,34 @@
 
 #include <tiny_os/common/types.h>
 #include <tiny_os/memory/page_table.h>
+#include <tiny_os/memory/pcid.h>
 
 namespace tiny_os::memory {
 
+// Pending TLB invalidations of one range operation. Up to MAX_PAGES pages
+// are flushed one by one with invlpg; beyond that a CR3 reload is cheaper,
+// or a global flush when kernel (global) pages are among them. Unlinked
+// page tables also need a global flush: kernel tables are shared by every
+// PCID, and any of them may still cache a pointer into the table.
+struct TlbBatch {
+    static constexpr usize MAX_PAGES = 32;
+
+    VirtualAddress pages[MAX_PAGES];
+    usize count = 0;
+    bool kernel = false;
+    bool tables = false;
+
+    void add(VirtualAddress virt);
+    void flush();
+};
+
+// Kernel-half mappings (is_kernel_address) are always made global, so they
+// survive CR3 switches and are invalidated in every PCID by invlpg.
+//
+// Every page table's present entries are counted (PhysicalAllocator::
+// table_entries). Unmapping frees a PT or PD whose count drops to zero;
+// the frame is recycled after the next global TLB flush. PDPTs stay, as
+// process address spaces share them through their PML4 entries.
 class VirtualAllocator {
 public:
     static void init();
@@ -12,8 +37,24 @@ public:
     // Map a virtual address to a physical address
     static void map_page(VirtualAddress virt, PhysicalAddress phys, uint64 flags);
 
-    // Unmap a virtual address
-    static void unmap_page(VirtualAddress virt);
+    // Map a 2MB or 1GB page; virt and phys must be aligned to page_size
+    static void map_huge_page(VirtualAddress virt, PhysicalAddress phys,
+                              usize page_size, uint64 flags);
+
+    // Map a physically contiguous range, using 1GB, 2MB or 4KB pages
+    // depending on the alignment of virt/phys and the remaining length.
+    // Each level is walked once per span and the TLB is flushed once.
+    static void map_range(VirtualAddress virt, PhysicalAddress phys,
+                          usize length, uint64 flags);
+
+    // Unmap every page in a range with a single TLB flush. Huge pages that
+    // stick out of the range are split first. With flush false the caller
+    // owns the TLB shootdown and must not reuse the range before it.
+    static void unmap_range(VirtualAddress virt, usize length, bool flush = true);
+
+    // Unmap the page containing virt, whatever its size.
+    // Returns the size of the page removed (0 if nothing was mapped).
+    static usize unmap_page(VirtualAddress virt);
 
     // Get physical address for virtual address
     static PhysicalAddress virt_to_phys(VirtualAddress virt);
@@ -27,14 +68,71 @@ public:
     // Switch page table (load CR3)
     static void switch_page_table(PhysicalAddress pml4_phys);
 
+    // Load an address space's page table under its PCID. Translations of
+    // other address spaces stay cached, so switching back is cheap.
+    static void switch_address_space(PhysicalAddress pml4_phys, PcidTag& tag);
+
+    // Load the kernel page table (PCID 0)
+    static void switch_to_kernel();
+
+    // Flush all non-global TLB entries (of every PCID)
+    static void flush_tlb();
+
+    // Flush all TLB entries, global kernel mappings included, and free the
+    // page tables unlinked since the last global flush
+    static void flush_tlb_global();
+
+    // Frames currently used by kernel page tables
+    static usize table_frames();
+
+    // PageFlags::NO_EXECUTE if the CPU supports it, 0 otherwise; for
+    // mappings of data such as stacks and buffers
+    static uint64 nx_flag() {
+        return nx_ ? PageFlags::NO_EXECUTE : 0;
+    }
+
 private:
     static PageTable* kernel_pml4_;
+    static bool gb_pages_;
+    static bool nx_;            // EFER.NXE set by boot.asm
+    static usize table_frames_;
+    static PhysicalAddress pending_tables_;     // Unlinked, chained through word 0
+    static bool physmap_ready_;
 
     // Ensure page table exists at given level
     static PageTable* ensure_table(PageTable* table, usize index, uint64 flags);
 
     // Get or create page table
     static PageTable* get_or_create_table(PageTableEntry& entry, uint64 flags);
+
+    // Replace a huge page entry with a table of smaller pages covering the
+    // same memory (page_size is the size of the huge page)
+    static PageTable* split_huge_page(PageTableEntry& entry, usize page_size);
+
+    // Allocate a zeroed page table frame
+    static PhysicalAddress allocate_table();
+
+    // Write or clear an entry, keeping its table's entry count
+    static void set_entry(PageTableEntry& entry, PhysicalAddress phys, uint64 flags);
+    static void clear_entry(PageTableEntry& entry);
+
+    // Clear parent and queue the empty table it points to for freeing
+    static void release_table(PageTableEntry& parent, TlbBatch& batch);
+
+    // Free a page table and the tables below it (level 1 = PT, 2 = PD)
+    static void free_table(PhysicalAddress table_phys, usize level);
+
+    // Install a huge page entry, replacing whatever was there
+    static void set_huge_entry(PageTableEntry& entry, PhysicalAddress phys, uint64 flags,
+                               usize table_level, VirtualAddress virt, TlbBatch& batch);
+
+    // Map one kernel image section [start, end) with flags and free the
+    // frames of the alignment padding between end and next
+    static void map_kernel_section(const uint8* start, const uint8* end,
+                                   const uint8* next, uint64 flags);
+
+    // End of the naturally aligned span containing virt, capped at end
+    static VirtualAddress span_end(VirtualAddress virt, usize span, VirtualAddress end);
 };
 
 } // namespace tiny_os::memory
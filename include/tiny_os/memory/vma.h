@@ -0,0 +1,98 @@
+#pragma once
+
+#include <tiny_os/common/types.h>
+#include <tiny_os/common/avl_tree.h>
+#include <tiny_os/memory/address_space.h>
+
+namespace tiny_os::memory {
+
+// Virtual memory area: a page-aligned range of a process address space
+// backed by zero-filled anonymous memory on first touch
+struct Vma {
+    VirtualAddress start;
+    VirtualAddress end;
+    uint64 flags;           // PageFlags of pages populated in the area
+
+    // Tree links (owned by VmaTree)
+    AvlNode node;
+    usize gap;              // Free space between the previous area and this one
+    usize max_gap;          // Largest gap in this subtree
+};
+
+struct VmaStartLess {
+    bool operator()(const Vma& a, const Vma& b) const {
+        return a.start < b.start;
+    }
+};
+
+// Keeps max_gap through rotations
+struct VmaGapAugment {
+    void operator()(Vma* vma, const Vma* left, const Vma* right) const {
+        usize gap = vma->gap;
+        if (left && left->max_gap > gap) gap = left->max_gap;
+        if (right && right->max_gap > gap) gap = right->max_gap;
+        vma->max_gap = gap;
+    }
+};
+
+// Per-process set of non-overlapping areas in an AVL tree keyed by start.
+//
+// Lookup, insert and removal take O(log n). Every node also records the
+// free gap in front of it and the largest gap in its subtree, so find_gap
+// places a new mapping in O(log n) without walking the areas.
+//
+// Inserting, splitting and removing may free areas: pointers returned
+// earlier are only good until the next modification.
+class VmaTree {
+public:
+    // Area containing addr, or nullptr
+    Vma* find(VirtualAddress addr) const;
+
+    // First area ending above addr, or nullptr
+    Vma* lower_bound(VirtualAddress addr) const;
+
+    // In-order traversal
+    Vma* first() const { return tree_.first(); }
+    Vma* last() const { return tree_.last(); }
+    static Vma* next(Vma* vma) { return Tree::next(vma); }
+    static Vma* prev(Vma* vma) { return Tree::prev(vma); }
+
+    // Add [start, end), merging with adjacent areas of equal flags.
+    // Returns the area now covering the range, or nullptr on overlap.
+    Vma* insert(VirtualAddress start, VirtualAddress end, uint64 flags);
+
+    // Split vma at addr; returns the upper part, or nullptr if addr is not
+    // strictly inside
+    Vma* split(Vma* vma, VirtualAddress addr);
+
+    // Remove [start, end) from the tree, trimming areas that stick out
+    void remove(VirtualAddress start, VirtualAddress end);
+
+    // Lowest user address with length free bytes (0 if none)
+    VirtualAddress find_gap(usize length) const;
+
+    // Replace the contents with a copy of other
+    void clone_from(const VmaTree& other);
+
+    // Replace the contents with other's areas, leaving other empty
+    void take_from(VmaTree& other);
+
+    void clear();
+
+    usize count() const { return count_; }
+
+private:
+    using Tree = AvlTree<Vma, &Vma::node, VmaStartLess, VmaGapAugment>;
+
+    Tree tree_;
+    usize count_ = 0;
+
+    Vma* create_node(VirtualAddress start, VirtualAddress end, uint64 flags);
+    void link_node(Vma* node);
+    void erase(Vma* node);
+
+    // Recompute the gap in front of vma and propagate it to the root
+    void fix_gap(Vma* vma);
+};
+
+} // namespace tiny_os::memory
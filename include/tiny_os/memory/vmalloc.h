@@ -0,0 +1,115 @@
+#pragma once
+
+#include <tiny_os/common/types.h>
+#include <tiny_os/common/avl_tree.h>
+
+namespace tiny_os::memory {
+
+// Range of the vmalloc region, free or busy.
+//
+// A free range sits in both free indices; a busy range only in the busy
+// index, through by_address. Ranges waiting for the lazy TLB purge are on a
+// singly linked list instead.
+struct VmapRange {
+    VirtualAddress start;
+    usize size;                 // Bytes, guard page included
+    bool backed;                // Frames allocated by vmalloc
+    VmapRange* next_lazy;
+    AvlNode by_address;
+    AvlNode by_size;
+};
+
+struct VmapRangeAddressLess {
+    bool operator()(const VmapRange& a, const VmapRange& b) const {
+        return a.start < b.start;
+    }
+};
+
+struct VmapRangeSizeLess {
+    bool operator()(const VmapRange& a, const VmapRange& b) const {
+        return a.size < b.size || (a.size == b.size && a.start < b.start);
+    }
+};
+
+// Kernel virtual address allocator for the vmalloc region.
+//
+// Free space is kept as ranges indexed twice: by address, so a freed range
+// coalesces with its neighbours in O(log n), and by (size, address), so the
+// best fitting range is found in O(log n). Every area is followed by an
+// unmapped guard page.
+//
+// vmalloc backs an area with individual frames, so large buffers are
+// virtually contiguous without consuming heap space or physically
+// contiguous memory. vfree returns the frames at once but leaves the
+// virtual range on a lazy list; when LAZY_PURGE_THRESHOLD bytes have
+// piled up, or an allocation fails, one global TLB flush retires them all.
+class Vmalloc {
+public:
+    static constexpr VirtualAddress START = 0xFFFFC90000000000ULL;
+    static constexpr VirtualAddress END = 0xFFFFE90000000000ULL;     // 32TB
+    static constexpr usize GUARD_SIZE = PAGE_SIZE;
+    static constexpr usize LAZY_PURGE_THRESHOLD = 32ULL * 1024 * 1024;
+
+    // VirtualAllocator::init must have run
+    static void init();
+
+    // Allocate and map size bytes (rounded up to pages). nullptr if the
+    // region is exhausted.
+    static void* vmalloc(usize size);
+
+    // Free a vmalloc area
+    static void vfree(void* ptr);
+
+    // Reserve address space for a caller that maps it itself; align is a
+    // power of two of at least PAGE_SIZE. Returns 0 on failure.
+    static VirtualAddress reserve(usize size, usize align = PAGE_SIZE);
+
+    // Return a reserved range; the caller must have unmapped it
+    static void release(VirtualAddress start);
+
+    // Flush the TLB once and return lazily freed ranges to the free indices
+    static void purge();
+
+    static bool contains(VirtualAddress virt) {
+        return virt >= START && virt < END;
+    }
+
+    static void print_stats();
+
+private:
+    using AddressTree = AvlTree<VmapRange, &VmapRange::by_address, VmapRangeAddressLess>;
+    using SizeTree = AvlTree<VmapRange, &VmapRange::by_size, VmapRangeSizeLess>;
+
+    static AddressTree free_by_address_;
+    static SizeTree free_by_size_;
+    static AddressTree busy_;
+    static VmapRange* lazy_;
+    static usize lazy_bytes_;
+
+    // Range descriptors are carved out of whole frames, not the heap
+    static VmapRange* spare_ranges_;
+
+    // Statistics
+    static usize busy_bytes_;
+    static usize busy_count_;
+    static uint64 purges_;
+
+    static VmapRange* new_range(VirtualAddress start, usize size);
+    static void delete_range(VmapRange* range);
+
+    // Carve size bytes aligned to align out of the free ranges
+    static VmapRange* allocate_range(usize size, usize align);
+    static VmapRange* find_fit(usize size, usize align);
+
+    // Busy range starting exactly at start
+    static VmapRange* find_busy(VirtualAddress start);
+
+    // Put a range into the free indices, merging it with its neighbours
+    static void insert_free(VmapRange* range);
+    static void remove_free(VmapRange* range);
+
+    // Hand a busy range to the lazy purge list
+    static void retire(VmapRange* range);
+};
+
+} // namespace tiny_os::memory
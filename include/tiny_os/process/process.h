@@ -2,12 +2,17 @@
 
 #include <tiny_os/common/types.h>
 #include <tiny_os/memory/page_table.h>
+#include <tiny_os/memory/pcid.h>
+#include <tiny_os/memory/vma.h>
 
 namespace tiny_os::process {
 
 // Forward declarations
 class Thread;
 
+// Priority of threads not given one (0-31, higher runs first)
+constexpr int DEFAULT_THREAD_PRIORITY = 10;
+
 // Process states
 enum class ProcessState {
     CREATED,        // Just created, not yet scheduled
@@ -25,6 +30,8 @@ struct Process {
     uint32 pid;                             // Process ID
     ProcessState state;                     // Current state
     memory::PageTable* page_table;          // Process address space (nullptr for kernel process)
+    memory::PcidTag pcid;                   // TLB tag of the address space
+    memory::VmaTree vmas;                   // Mapped user areas
 
     // Threads
     Thread* main_thread;                    // Main thread
@@ -51,8 +58,24 @@ public:
     // Initialize the process manager
     static void init();
 
-    // Create a kernel process (runs in kernel mode)
-    static Process* create_kernel_process(const char* name, void (*entry_point)());
+    // Create a kernel process (runs in kernel mode); its main thread gets
+    // the given priority
+    static Process* create_kernel_process(const char* name, void (*entry_point)(),
+                                          int priority = DEFAULT_THREAD_PRIORITY);
+
+    // Create a child of parent with a copy-on-write clone of its address
+    // space. The child's main thread starts at entry_point with the
+    // priority of the parent's main thread.
+    static Process* fork(Process* parent, const char* name, void (*entry_point)());
+
+    // Map length bytes of zero-filled memory, populated on first touch. A
+    // zero addr picks the lowest free range. Returns the address or 0; the
+    // process needs its own address space.
+    static VirtualAddress mmap(Process* process, VirtualAddress addr, usize length,
+                               uint64 flags);
+
+    // Unmap [addr, addr + length) and release its pages
+    static void munmap(Process* process, VirtualAddress addr, usize length);
 
     // Get current process
     static Process* get_current();
@@ -82,6 +105,11 @@ private:
     static Process* current_process_;
 
     static uint32 allocate_pid();
+
+    static Process* create_process(const char* name, void (*entry_point)(),
+                                   memory::PageTable* page_table, Process* parent,
+                                   int priority);
+    static void add_child(Process* parent, Process* child);
 };
 
 } // namespace tiny_os::process
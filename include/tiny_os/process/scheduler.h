@@ -5,22 +5,56 @@
 
 namespace tiny_os::process {
 
-// Simple Round-Robin scheduler
+// Threads queued at one priority, oldest first
+struct RunQueue {
+    Thread* head;
+    Thread* tail;
+};
+
+// O(1) priority scheduler.
+//
+// Every priority (0-31) has its own FIFO run queue and a bit in a 32-bit
+// occupancy bitmap, so the next thread is the head of the queue picked by
+// one bsr. Threads of equal priority take turns, each running for a time
+// slice unless a higher priority thread becomes ready, which preempts it
+// immediately.
+//
+// Waiting threads age: the head of a queue that has waited
+// STARVATION_TICKS moves up one level, and a thread that reaches a busy
+// level takes its turn there. Its boost ends when it runs.
 class Scheduler {
 public:
+    static constexpr usize PRIORITY_LEVELS = 32;
+    static constexpr uint64 TIME_SLICE = 10;            // Ticks (100ms @ 100Hz)
+    static constexpr uint64 AGING_INTERVAL = 5;         // Ticks between aging passes
+    static constexpr uint64 STARVATION_TICKS = 20;      // Wait before moving up a level
+
     // Initialize the scheduler
     static void init();
 
     // Start scheduling (enables timer-based preemption)
     static void start();
 
-    // Add a thread to the ready queue
+    // Make a thread ready; it preempts the current thread if it has a
+    // higher priority
     static void add_thread(Thread* thread);
 
-    // Remove a thread from the ready queue
+    // Remove a thread from its run queue
     static void remove_thread(Thread* thread);
 
-    // Schedule next thread (called from timer interrupt)
+    // Change a thread's priority (clamped to 0-31). A ready thread moves to
+    // its new run queue; if it now outranks the current thread, or the
+    // current thread drops below a ready one, the CPU is handed over at once.
+    static void set_priority(Thread* thread, int priority);
+
+    // Clamp a priority to the valid levels
+    static int clamp_priority(int priority);
+
+    // Timer tick: charge the current thread, age waiting threads and
+    // reschedule when the slice is used up or a higher priority is ready
+    static void tick();
+
+    // Switch to the highest priority ready thread
     static void schedule();
 
     // Yield CPU to next thread
@@ -39,22 +73,34 @@ public:
     static void print_stats();
 
 private:
-    static constexpr usize MAX_READY_THREADS = 256;
-
-    // Simple circular queue for round-robin scheduling
-    static Thread* ready_queue_[MAX_READY_THREADS];
-    static usize ready_queue_head_;
-    static usize ready_queue_tail_;
-    static usize ready_queue_size_;
+    static RunQueue run_queues_[PRIORITY_LEVELS];
+    static uint32 ready_bitmap_;        // Bit n set: run_queues_[n] is not empty
+    static usize ready_count_;
 
     static Thread* current_thread_;
     static Thread* idle_thread_;
     static bool scheduling_enabled_;
 
     static uint64 context_switches_;
+    static uint64 preemptions_;
+    static uint64 aged_;
     static uint64 idle_time_;
 
-    // Get next thread from ready queue
+    // Run queue of a thread's effective priority
+    static void enqueue(Thread* thread);
+    static void dequeue(Thread* thread);
+    static bool is_queued(Thread* thread);
+
+    // Highest level with a ready thread; ready_bitmap_ must not be empty
+    static usize highest_ready_level();
+
+    // Whether a ready thread at `level` should displace the current thread
+    static bool outranks_current(usize level);
+
+    // Move long-waiting queue heads up a level
+    static void age_ready_threads();
+
+    // Get next thread from the run queues
     static Thread* get_next_thread();
 
     // Perform context switch
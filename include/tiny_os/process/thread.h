@@ -2,6 +2,7 @@
 
 #include <tiny_os/common/types.h>
 #include <tiny_os/process/process.h>
+#include <tiny_os/memory/arena.h>
 
 namespace tiny_os::process {
 
@@ -46,8 +47,18 @@ struct Thread {
 
     // Scheduling
     int priority;                       // Priority (0-31, higher = more important)
+    int effective_priority;             // Priority raised by aging while ready
     uint64 time_slice_remaining;        // Remaining time slice (ticks)
     uint64 total_runtime;               // Total runtime (ticks)
+    uint64 ready_since;                 // Tick it joined its run queue
+    Thread* next_ready;                 // Run queue links
+    Thread* prev_ready;
+
+    // Scratch memory (memory::Arena::scratch)
+    memory::Arena scratch;
+
+    // Exited threads waiting for their stack to be released
+    Thread* next_zombie;
 
     // Name (for debugging)
     char name[64];
@@ -59,9 +70,10 @@ public:
     // Initialize the thread manager
     static void init();
 
-    // Create a kernel thread
+    // Create a kernel thread at the given priority (0-31, higher runs first)
     static Thread* create_kernel_thread(Process* process, const char* name,
-                                       void (*entry_point)());
+                                       void (*entry_point)(),
+                                       int priority = DEFAULT_THREAD_PRIORITY);
 
     // Get current thread
     static Thread* get_current();
@@ -69,19 +81,20 @@ public:
     // Set current thread
     static void set_current(Thread* thread);
 
-    // Terminate current thread
+    // Terminate current thread. Its TCB and stack are released by a later
+    // reap, once another thread runs.
     [[noreturn]] static void exit_thread(int exit_code);
 
+    // Free the TCBs and stacks of exited threads other than the current one
+    static void reap();
+
     // Sleep current thread (yield)
     static void yield();
 
 private:
-    static constexpr usize DEFAULT_STACK_SIZE = 16 * 1024;  // 16KB
-    static constexpr int DEFAULT_PRIORITY = 10;
-    static constexpr uint64 DEFAULT_TIME_SLICE = 10;        // 10 ticks = 100ms @ 100Hz
-
     static uint32 next_tid_;
     static Thread* current_thread_;
+    static Thread* zombies_;
 
     static uint32 allocate_tid();
 
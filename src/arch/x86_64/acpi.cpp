@@ -0,0 +1,279 @@
+#include <tiny_os/arch/x86_64/acpi.h>
+#include <tiny_os/common/multiboot2.h>
+#include <tiny_os/common/string.h>
+#include <tiny_os/memory/physmap.h>
+#include <tiny_os/drivers/serial.h>
+
+namespace tiny_os::arch::x86_64 {
+
+const AcpiSdtHeader* ACPI::rsdt_ = nullptr;
+bool ACPI::xsdt_ = false;
+
+usize ACPI::node_count_ = 1;
+uint32 ACPI::node_domains_[MAX_NUMA_NODES] = {};
+NumaMemoryRange ACPI::memory_ranges_[MAX_MEMORY_RANGES] = {};
+usize ACPI::memory_range_count_ = 0;
+uint8 ACPI::apic_nodes_[MAX_APIC_IDS] = {};
+uint8 ACPI::distances_[MAX_NUMA_NODES][MAX_NUMA_NODES] = {};
+
+namespace {
+
+// SRAT entry types
+constexpr uint8 SRAT_PROCESSOR_AFFINITY = 0;
+constexpr uint8 SRAT_MEMORY_AFFINITY = 1;
+constexpr uint8 SRAT_X2APIC_AFFINITY = 2;
+
+constexpr uint32 SRAT_ENABLED = 1U << 0;
+
+// Entries start after the header and 12 reserved bytes
+constexpr usize SRAT_ENTRIES_OFFSET = sizeof(AcpiSdtHeader) + 12;
+
+struct SratProcessorAffinity {
+    uint8 type;
+    uint8 length;
+    uint8 domain_low;
+    uint8 apic_id;
+    uint32 flags;
+    uint8 sapic_eid;
+    uint8 domain_high[3];
+    uint32 clock_domain;
+} __attribute__((packed));
+
+struct SratMemoryAffinity {
+    uint8 type;
+    uint8 length;
+    uint32 domain;
+    uint16 reserved1;
+    uint64 base;
+    uint64 length_bytes;
+    uint32 reserved2;
+    uint32 flags;
+    uint64 reserved3;
+} __attribute__((packed));
+
+struct SratX2ApicAffinity {
+    uint8 type;
+    uint8 length;
+    uint16 reserved1;
+    uint32 domain;
+    uint32 x2apic_id;
+    uint32 flags;
+    uint32 clock_domain;
+    uint32 reserved2;
+} __attribute__((packed));
+
+} // namespace
+
+void ACPI::init() {
+    // Default topology: one node owning all memory and CPUs
+    node_count_ = 1;
+    node_domains_[0] = 0;
+    memory_range_count_ = 0;
+    for (usize i = 0; i < MAX_NUMA_NODES; i++) {
+        for (usize j = 0; j < MAX_NUMA_NODES; j++) {
+            distances_[i][j] = (i == j) ? LOCAL_DISTANCE : REMOTE_DISTANCE;
+        }
+    }
+
+    // Multiboot2 hands us a copy of the RSDP; prefer the ACPI 2.0 one
+    const MultibootTag* tag = Multiboot2::find_tag(MultibootTagType::ACPI_NEW);
+    if (!tag) {
+        tag = Multiboot2::find_tag(MultibootTagType::ACPI_OLD);
+    }
+    if (!tag) {
+        drivers::serial_printf("[ACPI] No RSDP provided, assuming one NUMA node\n");
+        return;
+    }
+
+    const auto* rsdp = reinterpret_cast<const AcpiRsdp*>(
+        reinterpret_cast<const uint8*>(tag) + sizeof(MultibootTag));
+
+    if (memcmp(rsdp->signature, "RSD PTR ", 8) != 0 || !checksum_ok(rsdp, 20)) {
+        drivers::serial_printf("[ACPI] Invalid RSDP\n");
+        return;
+    }
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_address != 0) {
+        rsdt_ = memory::phys_to_virt<const AcpiSdtHeader>(rsdp->xsdt_address);
+        xsdt_ = true;
+    } else {
+        rsdt_ = memory::phys_to_virt<const AcpiSdtHeader>(rsdp->rsdt_address);
+        xsdt_ = false;
+    }
+
+    if (!checksum_ok(rsdt_, rsdt_->length)) {
+        drivers::serial_printf("[ACPI] Invalid %s\n", xsdt_ ? "XSDT" : "RSDT");
+        rsdt_ = nullptr;
+        return;
+    }
+
+    drivers::serial_printf("[ACPI] %s at 0x%lx\n", xsdt_ ? "XSDT" : "RSDT",
+                          memory::virt_to_phys(rsdt_));
+
+    if (const AcpiSdtHeader* srat = find_table("SRAT")) {
+        parse_srat(srat);
+    }
+    if (const AcpiSdtHeader* slit = find_table("SLIT")) {
+        parse_slit(slit);
+    }
+
+    drivers::serial_printf("[ACPI] %lu NUMA node(s), %lu memory range(s)\n",
+                          node_count_, memory_range_count_);
+    for (usize i = 0; i < memory_range_count_; i++) {
+        drivers::serial_printf("[ACPI]   node %u: 0x%lx - 0x%lx\n",
+                              memory_ranges_[i].node,
+                              memory_ranges_[i].base,
+                              memory_ranges_[i].base + memory_ranges_[i].length - 1);
+    }
+}
+
+const AcpiSdtHeader* ACPI::find_table(const char* signature) {
+    if (!rsdt_) return nullptr;
+
+    usize entry_size = xsdt_ ? 8 : 4;
+    usize count = (rsdt_->length - sizeof(AcpiSdtHeader)) / entry_size;
+    const uint8* entries = reinterpret_cast<const uint8*>(rsdt_) + sizeof(AcpiSdtHeader);
+
+    for (usize i = 0; i < count; i++) {
+        uint64 addr = 0;
+        memcpy(&addr, entries + i * entry_size, entry_size);
+
+        const auto* table = memory::phys_to_virt<const AcpiSdtHeader>(addr);
+        if (memcmp(table->signature, signature, 4) == 0 &&
+            checksum_ok(table, table->length)) {
+            return table;
+        }
+    }
+
+    return nullptr;
+}
+
+usize ACPI::numa_node_count() {
+    return node_count_;
+}
+
+usize ACPI::memory_range_count() {
+    return memory_range_count_;
+}
+
+const NumaMemoryRange& ACPI::memory_range(usize index) {
+    return memory_ranges_[index];
+}
+
+usize ACPI::node_for_apic(uint32 apic_id) {
+    return apic_id < MAX_APIC_IDS ? apic_nodes_[apic_id] : 0;
+}
+
+uint8 ACPI::node_distance(usize from, usize to) {
+    return distances_[from][to];
+}
+
+bool ACPI::checksum_ok(const void* data, usize length) {
+    const auto* bytes = static_cast<const uint8*>(data);
+    uint8 sum = 0;
+    for (usize i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+usize ACPI::node_for_domain(uint32 domain) {
+    // Proximity domains are sparse 32-bit IDs; nodes are dense indices
+    for (usize node = 0; node < node_count_; node++) {
+        if (node_domains_[node] == domain) return node;
+    }
+
+    if (node_count_ == MAX_NUMA_NODES) {
+        drivers::serial_printf("[ACPI] Too many proximity domains, folding %u into node 0\n",
+                              domain);
+        return 0;
+    }
+
+    node_domains_[node_count_] = domain;
+    return node_count_++;
+}
+
+void ACPI::parse_srat(const AcpiSdtHeader* srat) {
+    // Node indices are assigned in order of first appearance
+    node_count_ = 0;
+
+    const uint8* entry = reinterpret_cast<const uint8*>(srat) + SRAT_ENTRIES_OFFSET;
+    const uint8* end = reinterpret_cast<const uint8*>(srat) + srat->length;
+
+    while (entry + 2 <= end && entry[1] != 0) {
+        switch (entry[0]) {
+            case SRAT_PROCESSOR_AFFINITY: {
+                const auto* cpu = reinterpret_cast<const SratProcessorAffinity*>(entry);
+                if (!(cpu->flags & SRAT_ENABLED)) break;
+
+                uint32 domain = cpu->domain_low |
+                                (static_cast<uint32>(cpu->domain_high[0]) << 8) |
+                                (static_cast<uint32>(cpu->domain_high[1]) << 16) |
+                                (static_cast<uint32>(cpu->domain_high[2]) << 24);
+                apic_nodes_[cpu->apic_id] = static_cast<uint8>(node_for_domain(domain));
+                break;
+            }
+
+            case SRAT_X2APIC_AFFINITY: {
+                const auto* cpu = reinterpret_cast<const SratX2ApicAffinity*>(entry);
+                if (!(cpu->flags & SRAT_ENABLED)) break;
+
+                usize node = node_for_domain(cpu->domain);
+                if (cpu->x2apic_id < MAX_APIC_IDS) {
+                    apic_nodes_[cpu->x2apic_id] = static_cast<uint8>(node);
+                }
+                break;
+            }
+
+            case SRAT_MEMORY_AFFINITY: {
+                const auto* mem = reinterpret_cast<const SratMemoryAffinity*>(entry);
+                if (!(mem->flags & SRAT_ENABLED) || mem->length_bytes == 0) break;
+
+                if (memory_range_count_ == MAX_MEMORY_RANGES) {
+                    drivers::serial_printf("[ACPI] Too many SRAT memory ranges\n");
+                    break;
+                }
+
+                NumaMemoryRange& range = memory_ranges_[memory_range_count_++];
+                range.base = mem->base;
+                range.length = mem->length_bytes;
+                range.node = static_cast<uint32>(node_for_domain(mem->domain));
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        entry += entry[1];
+    }
+
+    if (node_count_ == 0) {
+        node_count_ = 1;
+    }
+}
+
+void ACPI::parse_slit(const AcpiSdtHeader* slit) {
+    const uint8* data = reinterpret_cast<const uint8*>(slit) + sizeof(AcpiSdtHeader);
+    uint64 localities = 0;
+    memcpy(&localities, data, sizeof(localities));
+    const uint8* matrix = data + sizeof(localities);
+
+    if (sizeof(AcpiSdtHeader) + sizeof(localities) + localities * localities > slit->length) {
+        drivers::serial_printf("[ACPI] Truncated SLIT\n");
+        return;
+    }
+
+    // The SLIT is indexed by proximity domain
+    for (usize from = 0; from < node_count_; from++) {
+        for (usize to = 0; to < node_count_; to++) {
+            uint64 a = node_domains_[from];
+            uint64 b = node_domains_[to];
+            if (a < localities && b < localities) {
+                distances_[from][to] = matrix[a * localities + b];
+            }
+        }
+    }
+}
+
+} // namespace tiny_os::arch::x86_64
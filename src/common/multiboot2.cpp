@@ -1,4 +1,5 @@
 #include <tiny_os/common/multiboot2.h>
+#include <tiny_os/common/string.h>
 #include <tiny_os/drivers/vga.h>
 #include <tiny_os/drivers/serial.h>
 
@@ -14,11 +15,15 @@ void Multiboot2::parse(void* multiboot_info) {
     drivers::serial_printf("Multiboot2 info size: %u bytes\n", total_size_);
 }
 
-const MultibootTag* Multiboot2::find_tag(MultibootTagType type) {
+const MultibootTag* Multiboot2::find_tag(MultibootTagType type, const MultibootTag* after) {
     if (!info_ptr_) return nullptr;
 
-    auto* tag = reinterpret_cast<MultibootTag*>(
+    auto* tag = reinterpret_cast<const MultibootTag*>(
         reinterpret_cast<uint8*>(info_ptr_) + 8);
+    if (after) {
+        tag = reinterpret_cast<const MultibootTag*>(
+            reinterpret_cast<const uint8*>(after) + ((after->size + 7) & ~7));
+    }
 
     while (tag->type != static_cast<uint32>(MultibootTagType::END)) {
         if (tag->type == static_cast<uint32>(type)) {
@@ -26,13 +31,36 @@ const MultibootTag* Multiboot2::find_tag(MultibootTagType type) {
         }
 
         // Align to 8-byte boundary
-        tag = reinterpret_cast<MultibootTag*>(
-            reinterpret_cast<uint8*>(tag) + ((tag->size + 7) & ~7));
+        tag = reinterpret_cast<const MultibootTag*>(
+            reinterpret_cast<const uint8*>(tag) + ((tag->size + 7) & ~7));
     }
 
     return nullptr;
 }
 
+bool Multiboot2::has_option(const char* option) {
+    const MultibootTag* tag = find_tag(MultibootTagType::CMDLINE);
+    if (!tag) return false;
+
+    // The tag holds a NUL-terminated string after its header
+    const char* cmdline = reinterpret_cast<const char*>(tag) + sizeof(MultibootTag);
+    usize length = strlen(option);
+
+    while (*cmdline) {
+        while (*cmdline == ' ') cmdline++;
+
+        const char* word = cmdline;
+        while (*cmdline && *cmdline != ' ') cmdline++;
+
+        if (static_cast<usize>(cmdline - word) == length &&
+            memcmp(word, option, length) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 void Multiboot2::print_memory_map() {
     auto* mmap_tag = reinterpret_cast<const MultibootTagMmap*>(
         find_tag(MultibootTagType::MMAP));
@@ -52,8 +52,8 @@ void Timer::timer_interrupt_handler(void* frame) {
     // Send EOI to PIC
     arch::x86_64::PIC::send_eoi(0);
 
-    // Call scheduler (Phase 4)
-    process::Scheduler::schedule();
+    // Time slices, aging and preemption
+    process::Scheduler::tick();
 }
 
 uint64 Timer::get_ticks() {
@@ -3,10 +3,22 @@
 #include <tiny_os/drivers/vga.h>
 #include <tiny_os/drivers/serial.h>
 #include <tiny_os/memory/heap_allocator.h>
+#include <tiny_os/memory/slab.h>
+#include <tiny_os/memory/arena.h>
+#include <tiny_os/memory/vmalloc.h>
 #include <tiny_os/common/string.h>
 
 namespace tiny_os::fs {
 
+namespace {
+
+memory::ObjectCache<Inode> inode_cache("inode");
+memory::ObjectCache<File> file_cache("file");
+memory::ObjectCache<FAT32InodeData> inode_data_cache("fat32_inode_data");
+memory::ObjectCache<FAT32DirEntry> dir_entry_cache("fat32_dir_entry");
+
+} // namespace
+
 FAT32* FAT32::mount(BlockDevice* device) {
     if (!device) return nullptr;
 
@@ -41,7 +53,7 @@ FAT32::~FAT32() {
         if (fat_dirty_) {
             flush_fat();
         }
-        delete[] fat_;
+        memory::Vmalloc::vfree(fat_);
     }
 }
 
@@ -104,9 +116,10 @@ bool FAT32::read_boot_sector() {
 }
 
 bool FAT32::read_fat() {
-    // Allocate FAT table (in memory)
+    // Allocate FAT table (in memory). It runs to megabytes on large
+    // volumes, so it is backed by single frames instead of the heap.
     usize fat_size = boot_sector_.fat_size_32 * boot_sector_.bytes_per_sector;
-    fat_ = new uint32[fat_size / 4];
+    fat_ = static_cast<uint32*>(memory::Vmalloc::vmalloc(fat_size));
     if (!fat_) {
         serial_printf("[FAT32] Failed to allocate FAT table\n");
         return false;
@@ -115,7 +128,7 @@ bool FAT32::read_fat() {
     // Read FAT from disk
     if (!device_->read_sectors(fat_start_lba_, boot_sector_.fat_size_32, fat_)) {
         serial_printf("[FAT32] Failed to read FAT table\n");
-        delete[] fat_;
+        memory::Vmalloc::vfree(fat_);
         fat_ = nullptr;
         return false;
     }
@@ -169,14 +182,14 @@ File* FAT32::open(const char* path, uint32 flags) {
 
     // Create inode
     Inode* inode = create_inode_from_entry(entry, dir_cluster, 0);
-    delete entry;
+    dir_entry_cache.free(entry);
 
     if (!inode) {
         return nullptr;
     }
 
     // Create file
-    File* file = new File();
+    File* file = file_cache.alloc();
     file->inode = inode;
     file->position = 0;
     file->flags = flags;
@@ -196,11 +209,11 @@ void FAT32::close(File* file) {
     if (file->ref_count == 0) {
         if (file->inode) {
             if (file->inode->fs_specific) {
-                delete static_cast<FAT32InodeData*>(file->inode->fs_specific);
+                inode_data_cache.free(static_cast<FAT32InodeData*>(file->inode->fs_specific));
             }
-            delete file->inode;
+            inode_cache.free(file->inode);
         }
-        delete file;
+        file_cache.free(file);
     }
 }
 
@@ -229,14 +242,14 @@ isize FAT32::read(File* file, void* buffer, usize count) {
         cluster = get_next_cluster(cluster);
     }
 
-    // Read data
+    // Read data through one scratch cluster buffer
     usize position_in_cluster = file->position % cluster_size_;
+    memory::ArenaScope scratch;
+    uint8* cluster_data = scratch.alloc_array<uint8>(cluster_size_);
 
     while (count > 0 && cluster < FAT32Cluster::EOC) {
         // Read cluster
-        uint8* cluster_data = new uint8[cluster_size_];
         if (!read_cluster(cluster, cluster_data)) {
-            delete[] cluster_data;
             break;
         }
 
@@ -247,7 +260,6 @@ isize FAT32::read(File* file, void* buffer, usize count) {
         }
 
         memcpy(buf + bytes_read, cluster_data + position_in_cluster, bytes_in_cluster);
-        delete[] cluster_data;
 
         bytes_read += bytes_in_cluster;
         count -= bytes_in_cluster;
@@ -304,7 +316,7 @@ Inode* FAT32::lookup(Inode* dir, const char* name) {
     if (!entry) return nullptr;
 
     Inode* inode = create_inode_from_entry(entry, data->first_cluster, 0);
-    delete entry;
+    dir_entry_cache.free(entry);
 
     return inode;
 }
@@ -346,7 +358,8 @@ FAT32DirEntry* FAT32::find_dir_entry(uint32 dir_cluster, const char* name) {
     char name83[11];
     name_to_83(name, name83);
 
-    uint8* cluster_data = new uint8[cluster_size_];
+    memory::ArenaScope scratch;
+    uint8* cluster_data = scratch.alloc_array<uint8>(cluster_size_);
     uint32 cluster = dir_cluster;
 
     while (cluster < FAT32Cluster::EOC) {
@@ -361,7 +374,6 @@ FAT32DirEntry* FAT32::find_dir_entry(uint32 dir_cluster, const char* name) {
         for (usize i = 0; i < entries_per_cluster; i++) {
             if (entries[i].name[0] == 0x00) {
                 // End of directory
-                delete[] cluster_data;
                 return nullptr;
             }
 
@@ -377,9 +389,8 @@ FAT32DirEntry* FAT32::find_dir_entry(uint32 dir_cluster, const char* name) {
 
             // Compare name
             if (memcmp(entries[i].name, name83, 11) == 0) {
-                FAT32DirEntry* result = new FAT32DirEntry();
+                FAT32DirEntry* result = dir_entry_cache.alloc();
                 *result = entries[i];
-                delete[] cluster_data;
                 return result;
             }
         }
@@ -388,7 +399,6 @@ FAT32DirEntry* FAT32::find_dir_entry(uint32 dir_cluster, const char* name) {
         cluster = get_next_cluster(cluster);
     }
 
-    delete[] cluster_data;
     return nullptr;
 }
 
@@ -408,9 +418,9 @@ bool FAT32::read_dir_entry(uint32 dir_cluster, usize index, FAT32DirEntry* entry
     }
 
     // Read cluster
-    uint8* cluster_data = new uint8[cluster_size_];
+    memory::ArenaScope scratch;
+    uint8* cluster_data = scratch.alloc_array<uint8>(cluster_size_);
     if (!read_cluster(cluster, cluster_data)) {
-        delete[] cluster_data;
         return false;
     }
 
@@ -418,7 +428,6 @@ bool FAT32::read_dir_entry(uint32 dir_cluster, usize index, FAT32DirEntry* entry
     FAT32DirEntry* entries = reinterpret_cast<FAT32DirEntry*>(cluster_data);
     *entry = entries[entry_index];
 
-    delete[] cluster_data;
     return true;
 }
 
@@ -481,8 +490,8 @@ void FAT32::name_from_83(const char* name83, char* name) {
 
 Inode* FAT32::create_inode_from_entry(const FAT32DirEntry* entry,
                                      uint32 dir_cluster, uint32 index) {
-    Inode* inode = new Inode();
-    FAT32InodeData* data = new FAT32InodeData();
+    Inode* inode = inode_cache.alloc();
+    FAT32InodeData* data = inode_data_cache.alloc();
 
     data->first_cluster = (entry->cluster_high << 16) | entry->cluster_low;
     data->dir_cluster = dir_cluster;
@@ -1,13 +1,19 @@
 #include <tiny_os/kernel/kernel.h>
+#include <tiny_os/common/multiboot2.h>
 #include <tiny_os/arch/x86_64/gdt.h>
 #include <tiny_os/arch/x86_64/idt.h>
 #include <tiny_os/arch/x86_64/pic.h>
 #include <tiny_os/drivers/vga.h>
 #include <tiny_os/drivers/serial.h>
 #include <tiny_os/drivers/timer.h>
+#include <tiny_os/memory/memblock.h>
 #include <tiny_os/memory/physical_allocator.h>
 #include <tiny_os/memory/virtual_allocator.h>
+#include <tiny_os/memory/physmap.h>
 #include <tiny_os/memory/heap_allocator.h>
+#include <tiny_os/memory/heap_profiler.h>
+#include <tiny_os/memory/vmalloc.h>
+#include <tiny_os/memory/demand_pager.h>
 #include <tiny_os/process/process.h>
 #include <tiny_os/process/thread.h>
 #include <tiny_os/process/scheduler.h>
@@ -71,15 +77,29 @@ extern "C" void kernel_main(uint32 magic, void* multiboot_info) {
 
     // Initialize physical memory allocator
     drivers::kprintf("\n--- Phase 2: Memory Management ---\n");
-    memory::PhysicalAllocator::init(multiboot_info);
+    // Early allocator over the memory map; the bootloader hands over a
+    // physical address
+    memory::Memblock::init(
+        memory::phys_to_virt(reinterpret_cast<PhysicalAddress>(multiboot_info)));
+    memory::PhysicalAllocator::init();
 
     // Initialize virtual memory
     memory::VirtualAllocator::init();
 
-    // Initialize kernel heap (16MB)
-    constexpr VirtualAddress HEAP_START = 0xFFFFFFFF90000000ULL;
-    constexpr usize HEAP_SIZE = 16 * 1024 * 1024;  // 16MB
-    memory::HeapAllocator::init(HEAP_START, HEAP_SIZE);
+    // Kernel virtual address space allocator
+    memory::Vmalloc::init();
+
+    // Initialize kernel heap: address space for as much heap as there is
+    // memory, 2MB aligned so its chunks map with huge pages
+    usize heap_max = (memory::PhysicalAllocator::memory_end() + PAGE_SIZE_2M - 1) &
+                     ~(PAGE_SIZE_2M - 1);
+    VirtualAddress heap_start = memory::Vmalloc::reserve(heap_max, PAGE_SIZE_2M);
+    memory::HeapAllocator::init(heap_start, heap_max);
+
+    // Boot with "heapprof" to charge heap usage to call sites
+    if (Multiboot2::has_option("heapprof")) {
+        memory::HeapProfiler::enable();
+    }
 
     // Test heap allocator
     drivers::kprintf("\nTesting heap allocator...\n");
@@ -88,6 +108,40 @@ extern "C" void kernel_main(uint32 magic, void* multiboot_info) {
     delete test_ptr;
     drivers::kprintf("Heap test: OK\n");
 
+    // Boot with "vmstress" to map and unmap 1M pages and check that every
+    // page table frame is given back
+    if (Multiboot2::has_option("vmstress")) {
+        drivers::kprintf("\nTesting page table reclaim...\n");
+
+        constexpr usize stress_pages = 1024 * 1024;
+        VirtualAddress base = memory::Vmalloc::reserve(stress_pages * PAGE_SIZE,
+                                                       PAGE_SIZE_2M);
+        usize tables_before = memory::VirtualAllocator::table_frames();
+        usize used_before = memory::PhysicalAllocator::used_frames();
+
+        // Every page maps the same frame, so only the tables cost memory
+        PhysicalAddress frame = memory::PhysicalAllocator::allocate_frame();
+        for (usize i = 0; i < stress_pages; i++) {
+            memory::VirtualAllocator::map_page(base + i * PAGE_SIZE, frame,
+                                               memory::PageFlags::PRESENT);
+        }
+        drivers::kprintf("Mapped %u pages using %u page tables\n", stress_pages,
+                        memory::VirtualAllocator::table_frames() - tables_before);
+
+        memory::VirtualAllocator::unmap_range(base, stress_pages * PAGE_SIZE);
+        memory::PhysicalAllocator::free_frame(frame);
+
+        usize tables_after = memory::VirtualAllocator::table_frames();
+        usize used_after = memory::PhysicalAllocator::used_frames();
+        memory::Vmalloc::release(base);
+        drivers::serial_printf("vmstress: tables %lu -> %lu, used frames %lu -> %lu\n",
+                              tables_before, tables_after, used_before, used_after);
+        if (tables_after != tables_before || used_after != used_before) {
+            panic("Page tables leaked by unmap_range");
+        }
+        drivers::kprintf("Page table reclaim test: OK\n");
+    }
+
     // Print memory stats
     memory::PhysicalAllocator::print_stats();
     memory::HeapAllocator::print_stats();
@@ -102,6 +156,9 @@ extern "C" void kernel_main(uint32 magic, void* multiboot_info) {
     drivers::kprintf("OK\n");
     drivers::VGA::set_color(Color::LIGHT_GRAY, Color::BLACK);
 
+    // Resolve page faults in process memory and copy-on-write pages
+    memory::DemandPager::init();
+
     // Initialize and remap PIC
     drivers::kprintf("Initializing PIC... ");
     arch::x86_64::PIC::init();
@@ -243,6 +300,10 @@ extern "C" void kernel_main(uint32 magic, void* multiboot_info) {
         drivers::kprintf("No ATA disk found (emulator may need disk image)\n");
     }
 
+    if (memory::HeapProfiler::enabled()) {
+        memory::HeapProfiler::report();
+    }
+
     // Print success message
     drivers::kprintf("\n");
     drivers::VGA::set_color(Color::YELLOW, Color::BLACK);
@@ -1,65 +1,41 @@
 #include <tiny_os/common/types.h>
+#include <tiny_os/memory/memblock.h>
+#include <tiny_os/memory/physmap.h>
 #include <tiny_os/drivers/vga.h>
 #include <cstddef>
 #include <cstdint>
 
 namespace tiny_os::kernel {
 
-// Temporary heap for early boot (before real heap allocator is ready)
-// This will be replaced with proper heap allocator in Phase 2
-static uint8 early_heap[1024 * 1024];  // 1MB early heap
-static usize early_heap_offset = 0;
+// Allocations before the kernel heap is ready are carved from page runs
+// reserved in memblock; they are never freed
+constexpr usize EARLY_CHUNK_SIZE = 16 * 1024;
+static uint8* early_chunk = nullptr;
+static usize early_chunk_left = 0;
 
 } // namespace tiny_os::kernel
 
-// Export for global operators
+// Used by the global operator new until the heap is up (heap_allocator.cpp)
 extern "C" void* tiny_os_early_malloc(size_t size) {
     using namespace tiny_os;
 
     // Align to 16 bytes
     size = (size + 15) & ~15;
 
-    if (kernel::early_heap_offset + size > sizeof(kernel::early_heap)) {
-        drivers::kprintf("PANIC: Early heap exhausted!\n");
-        while (true) {
-            asm volatile("cli; hlt");
-        }
+    if (size > kernel::early_chunk_left) {
+        // The rest of the current run is abandoned
+        usize chunk = size > kernel::EARLY_CHUNK_SIZE ? page_align_up(size)
+                                                      : kernel::EARLY_CHUNK_SIZE;
+        kernel::early_chunk = memory::phys_to_virt<uint8>(memory::Memblock::alloc(chunk));
+        kernel::early_chunk_left = chunk;
     }
 
-    void* ptr = &kernel::early_heap[kernel::early_heap_offset];
-    kernel::early_heap_offset += size;
+    void* ptr = kernel::early_chunk;
+    kernel::early_chunk += size;
+    kernel::early_chunk_left -= size;
     return ptr;
 }
 
-// Global operator new/delete implementations
-void* operator new(size_t size) {
-    return tiny_os_early_malloc(size);
-}
-
-void* operator new[](size_t size) {
-    return tiny_os_early_malloc(size);
-}
-
-void operator delete(void* ptr) noexcept {
-    // Early heap doesn't support freeing
-    // This will be properly implemented in Phase 2
-    (void)ptr;
-}
-
-void operator delete[](void* ptr) noexcept {
-    (void)ptr;
-}
-
-void operator delete(void* ptr, size_t size) noexcept {
-    (void)ptr;
-    (void)size;
-}
-
-void operator delete[](void* ptr, size_t size) noexcept {
-    (void)ptr;
-    (void)size;
-}
-
 // Required C++ runtime support functions
 extern "C" {
 
@@ -0,0 +1,256 @@
+#include <tiny_os/memory/address_space.h>
+#include <tiny_os/memory/physical_allocator.h>
+#include <tiny_os/memory/virtual_allocator.h>
+#include <tiny_os/memory/physmap.h>
+#include <tiny_os/common/string.h>
+#include <tiny_os/drivers/vga.h>
+#include <tiny_os/drivers/serial.h>
+
+namespace tiny_os::memory {
+
+uint64 AddressSpace::cow_faults_ = 0;
+uint64 AddressSpace::cow_copies_ = 0;
+
+namespace {
+
+constexpr uint64 ADDRESS_MASK = 0x000FFFFFFFFFF000ULL;
+constexpr uint64 TABLE_FLAGS = PageFlags::PRESENT | PageFlags::WRITABLE | PageFlags::USER;
+
+PhysicalAddress allocate_table() {
+    PhysicalAddress phys = PhysicalAllocator::allocate_frame();
+    phys_to_virt<PageTable>(phys)->clear();
+    return phys;
+}
+
+bool is_user_address(VirtualAddress virt) {
+    return virt >= USER_SPACE_START && virt < USER_SPACE_END;
+}
+
+} // namespace
+
+PageTable* AddressSpace::create() {
+    PhysicalAddress phys = allocate_table();
+    PageTable* pml4 = phys_to_virt<PageTable>(phys);
+    PageTable* kernel = VirtualAllocator::get_kernel_pml4();
+
+    // Kernel entries point at the same PDPTs, so kernel mappings made later
+    // show up everywhere (VirtualAllocator::init populates all of them)
+    (*pml4)[0] = (*kernel)[0];
+    for (usize i = USER_PML4_END; i < 512; i++) {
+        (*pml4)[i] = (*kernel)[i];
+    }
+
+    return pml4;
+}
+
+PageTable* AddressSpace::clone(PageTable* parent) {
+    PageTable* child = create();
+
+    for (usize i = USER_PML4_FIRST; i < USER_PML4_END; i++) {
+        PageTableEntry& entry = (*parent)[i];
+        if (!entry.is_present()) continue;
+
+        PhysicalAddress pdpt = clone_table(phys_to_virt<PageTable>(entry.get_address()), 3);
+        (*child)[i].set_address(pdpt, entry.value & ~ADDRESS_MASK);
+    }
+
+    return child;
+}
+
+void AddressSpace::destroy(PageTable* pml4) {
+    if (pml4 == current()) {
+        drivers::serial_printf("WARNING: Destroying the live address space\n");
+        return;
+    }
+
+    for (usize i = USER_PML4_FIRST; i < USER_PML4_END; i++) {
+        if ((*pml4)[i].is_present()) {
+            destroy_table((*pml4)[i].get_address(), 3);
+        }
+    }
+
+    PhysicalAllocator::free_frame(memory::virt_to_phys(pml4));
+}
+
+bool AddressSpace::map_page(PageTable* pml4, VirtualAddress virt, PhysicalAddress phys,
+                            uint64 flags) {
+    if (!is_user_address(virt) || !is_page_aligned(virt)) {
+        drivers::serial_printf("WARNING: Bad user mapping 0x%lx\n", virt);
+        return false;
+    }
+
+    auto indices = PageTableIndices::from_address(virt);
+    uint16 path[3] = {indices.pml4, indices.pdpt, indices.pd};
+
+    // User space only holds 4KB pages
+    PageTable* table = pml4;
+    for (uint16 index : path) {
+        PageTableEntry& entry = (*table)[index];
+        if (!entry.is_present()) {
+            entry.set_address(allocate_table(), TABLE_FLAGS);
+        }
+        table = phys_to_virt<PageTable>(entry.get_address());
+    }
+
+    PageTableEntry& leaf = (*table)[indices.pt];
+    if (leaf.is_present()) {
+        return false;
+    }
+
+    // Not-present entries are never cached, so no flush is needed
+    leaf.set_address(phys, flags | PageFlags::PRESENT | PageFlags::USER);
+    return true;
+}
+
+void AddressSpace::unmap_range(PageTable* pml4, PcidTag& tag,
+                               VirtualAddress start, VirtualAddress end) {
+    VirtualAddress pages[TlbBatch::MAX_PAGES];
+    usize count = 0;
+
+    VirtualAddress virt = start;
+    while (virt < end) {
+        PageTableEntry* entry = find_entry(pml4, virt);
+        if (!entry) {
+            // No page table here: skip to the next one
+            virt = (virt & ~(PAGE_SIZE_2M - 1)) + PAGE_SIZE_2M;
+            continue;
+        }
+
+        if (entry->is_present()) {
+            PhysicalAllocator::unref_frame(entry->get_address());
+            entry->clear();
+            if (count < TlbBatch::MAX_PAGES) {
+                pages[count] = virt;
+            }
+            count++;
+        }
+        virt += PAGE_SIZE;
+    }
+
+    if (count > TlbBatch::MAX_PAGES) {
+        flush_tlb(pml4, tag);
+        return;
+    }
+
+    // Without PCIDs only the live space has translations cached
+    if (!Pcid::enabled() && pml4 != current()) {
+        return;
+    }
+    for (usize i = 0; i < count; i++) {
+        Pcid::invalidate_page(tag, pages[i]);
+    }
+}
+
+PhysicalAddress AddressSpace::virt_to_phys(PageTable* pml4, VirtualAddress virt) {
+    PageTableEntry* entry = find_entry(pml4, virt);
+    if (!entry || !entry->is_present()) return 0;
+    return entry->get_address() + (virt & (PAGE_SIZE - 1));
+}
+
+bool AddressSpace::handle_write_fault(VirtualAddress virt) {
+    if (!is_user_address(virt)) return false;
+
+    PageTableEntry* entry = find_entry(current(), virt);
+    if (!entry || !entry->is_present() || !(entry->value & PageFlags::COPY_ON_WRITE)) {
+        return false;
+    }
+
+    cow_faults_++;
+
+    PhysicalAddress old_frame = entry->get_address();
+    uint64 flags = (entry->value & ~ADDRESS_MASK & ~PageFlags::COPY_ON_WRITE) |
+                   PageFlags::WRITABLE;
+
+    if (PhysicalAllocator::frame_refs(old_frame) == 1) {
+        // Every other sharer has written or gone away: take the frame over
+        entry->set_address(old_frame, flags);
+    } else {
+        PhysicalAddress new_frame = PhysicalAllocator::allocate_frame();
+        memcpy(phys_to_virt(new_frame), phys_to_virt(old_frame), PAGE_SIZE);
+        entry->set_address(new_frame, flags);
+        PhysicalAllocator::unref_frame(old_frame);
+        cow_copies_++;
+    }
+
+    asm volatile("invlpg (%0)" : : "r"(page_align_down(virt)) : "memory");
+    return true;
+}
+
+void AddressSpace::flush_tlb(PageTable* pml4, PcidTag& tag) {
+    if (Pcid::enabled()) {
+        Pcid::invalidate_context(tag);
+    } else if (pml4 == current()) {
+        VirtualAllocator::flush_tlb();
+    }
+}
+
+PageTable* AddressSpace::current() {
+    uint64 cr3;
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    return phys_to_virt<PageTable>(cr3 & ADDRESS_MASK);
+}
+
+void AddressSpace::print_stats() {
+    drivers::kprintf("\n=== Copy-on-Write Statistics ===\n");
+    drivers::kprintf("COW faults: %u\n", cow_faults_);
+    drivers::kprintf("Frames copied: %u\n", cow_copies_);
+    drivers::kprintf("\n");
+}
+
+PhysicalAddress AddressSpace::clone_table(PageTable* parent, usize level) {
+    PhysicalAddress child_phys = allocate_table();
+    PageTable* child = phys_to_virt<PageTable>(child_phys);
+
+    for (usize i = 0; i < 512; i++) {
+        PageTableEntry& entry = (*parent)[i];
+        if (!entry.is_present()) continue;
+
+        if (level > 1) {
+            PhysicalAddress table = clone_table(phys_to_virt<PageTable>(entry.get_address()),
+                                                level - 1);
+            (*child)[i].set_address(table, entry.value & ~ADDRESS_MASK);
+            continue;
+        }
+
+        // Both sides lose write access until the first write fault
+        if (entry.is_writable()) {
+            entry.value = (entry.value & ~PageFlags::WRITABLE) | PageFlags::COPY_ON_WRITE;
+        }
+        PhysicalAllocator::ref_frame(entry.get_address());
+        (*child)[i] = entry;
+    }
+
+    return child_phys;
+}
+
+void AddressSpace::destroy_table(PhysicalAddress table_phys, usize level) {
+    PageTable* table = phys_to_virt<PageTable>(table_phys);
+
+    for (usize i = 0; i < 512; i++) {
+        if (!(*table)[i].is_present()) continue;
+
+        if (level > 1) {
+            destroy_table((*table)[i].get_address(), level - 1);
+        } else {
+            PhysicalAllocator::unref_frame((*table)[i].get_address());
+        }
+    }
+
+    PhysicalAllocator::free_frame(table_phys);
+}
+
+PageTableEntry* AddressSpace::find_entry(PageTable* pml4, VirtualAddress virt) {
+    auto indices = PageTableIndices::from_address(virt);
+    uint16 path[3] = {indices.pml4, indices.pdpt, indices.pd};
+
+    PageTable* table = pml4;
+    for (uint16 index : path) {
+        const PageTableEntry& entry = (*table)[index];
+        if (!entry.is_present()) return nullptr;
+        table = phys_to_virt<PageTable>(entry.get_address());
+    }
+
+    return &(*table)[indices.pt];
+}
+
+} // namespace tiny_os::memory
@@ -0,0 +1,121 @@
+#include <tiny_os/memory/arena.h>
+#include <tiny_os/memory/physical_allocator.h>
+#include <tiny_os/memory/physmap.h>
+#include <tiny_os/process/thread.h>
+#include <tiny_os/arch/x86_64/idt.h>
+#include <tiny_os/drivers/vga.h>
+#include <tiny_os/drivers/serial.h>
+
+namespace tiny_os::memory {
+
+ArenaChunk* Arena::pool_ = nullptr;
+usize Arena::pooled_ = 0;
+uint64 Arena::chunk_allocs_ = 0;
+uint64 Arena::pool_hits_ = 0;
+
+namespace {
+
+// Used until the first thread runs
+Arena boot_arena;
+
+constexpr usize align_up(usize value, usize align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+} // namespace
+
+void* Arena::alloc(usize size, usize align) {
+    if (size == 0) return nullptr;
+
+    usize offset = align_up(offset_, align);
+    if (!chunk_ || offset + size > chunk_->size) {
+        // Start a new chunk; whatever is left of the current one is skipped
+        usize header = align_up(sizeof(ArenaChunk), align);
+        ArenaChunk* chunk = get_chunk(align_up(header + size, PAGE_SIZE));
+        chunk->next = chunk_;
+        chunk_ = chunk;
+        offset = header;
+    }
+
+    offset_ = offset + size;
+    return reinterpret_cast<uint8*>(chunk_) + offset;
+}
+
+void Arena::reset(Mark mark) {
+    while (chunk_ != mark.chunk) {
+        ArenaChunk* chunk = chunk_;
+        chunk_ = chunk->next;
+        put_chunk(chunk);
+    }
+    offset_ = mark.offset;
+}
+
+Arena& Arena::scratch() {
+    process::Thread* thread = process::ThreadManager::get_current();
+    return thread ? thread->scratch : boot_arena;
+}
+
+void Arena::print_stats() {
+    drivers::kprintf("\n=== Arena Statistics ===\n");
+    drivers::kprintf("Chunks allocated: %u\n", chunk_allocs_);
+    drivers::kprintf("Pool hits:        %u\n", pool_hits_);
+    drivers::kprintf("Pooled:           %u KB\n", pooled_ * CHUNK_SIZE / 1024);
+
+    drivers::serial_printf("Arena: %lu chunk allocs, %lu pool hits, %lu pooled\n",
+                          chunk_allocs_, pool_hits_, pooled_);
+}
+
+ArenaChunk* Arena::get_chunk(usize size) {
+    if (size < CHUNK_SIZE) {
+        size = CHUNK_SIZE;
+    }
+
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    ArenaChunk* chunk = nullptr;
+    if (size == CHUNK_SIZE && pool_) {
+        chunk = pool_;
+        pool_ = chunk->next;
+        pooled_--;
+        pool_hits_++;
+    } else {
+        PhysicalAddress phys = PhysicalAllocator::allocate_frames(size / PAGE_SIZE);
+        chunk = phys_to_virt<ArenaChunk>(phys);
+        chunk->size = size;
+        chunk_allocs_++;
+    }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+
+    return chunk;
+}
+
+void Arena::put_chunk(ArenaChunk* chunk) {
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    // Oversized chunks, and anything beyond the pool limit, go straight back
+    bool pooled = chunk->size == CHUNK_SIZE && pooled_ < POOL_LIMIT;
+    if (pooled) {
+        chunk->next = pool_;
+        pool_ = chunk;
+        pooled_++;
+    }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+
+    if (!pooled) {
+        PhysicalAllocator::free_frames(virt_to_phys(chunk), chunk->size / PAGE_SIZE);
+    }
+}
+
+} // namespace tiny_os::memory
@@ -0,0 +1,109 @@
+#include <tiny_os/memory/demand_pager.h>
+#include <tiny_os/memory/physical_allocator.h>
+#include <tiny_os/memory/physmap.h>
+#include <tiny_os/memory/address_space.h>
+#include <tiny_os/process/scheduler.h>
+#include <tiny_os/process/thread.h>
+#include <tiny_os/arch/x86_64/idt.h>
+#include <tiny_os/common/string.h>
+#include <tiny_os/drivers/vga.h>
+#include <tiny_os/drivers/serial.h>
+#include <tiny_os/kernel/kernel.h>
+
+namespace tiny_os::memory {
+
+uint64 DemandPager::faults_ = 0;
+uint64 DemandPager::pages_populated_ = 0;
+
+void DemandPager::init() {
+    arch::x86_64::IDT::register_handler(14, page_fault_handler);
+    drivers::serial_printf("[DemandPager] Page fault handler installed\n");
+}
+
+bool DemandPager::handle_fault(VirtualAddress addr, uint64 error_code) {
+    // Writes to present pages may be copy-on-write
+    if ((error_code & PageFaultError::PRESENT) && (error_code & PageFaultError::WRITE) &&
+        !(error_code & PageFaultError::RESERVED)) {
+        return AddressSpace::handle_write_fault(addr);
+    }
+
+    // Otherwise only missing pages are ours; protection faults are real errors
+    if (error_code & (PageFaultError::PRESENT | PageFaultError::RESERVED)) {
+        return false;
+    }
+
+    // Only areas of the current process are backed lazily
+    if (addr < USER_SPACE_START || addr >= USER_SPACE_END) {
+        return false;
+    }
+
+    process::Thread* thread = process::Scheduler::current_thread();
+    process::Process* owner = thread ? thread->process : nullptr;
+    if (!owner || !owner->page_table) {
+        return false;
+    }
+
+    const Vma* vma = owner->vmas.find(addr);
+    if (!vma) {
+        return false;
+    }
+
+    uint64 flags = vma->flags | PageFlags::PRESENT | PageFlags::USER;
+    if ((error_code & PageFaultError::WRITE) && !(flags & PageFlags::WRITABLE)) {
+        return false;
+    }
+
+    faults_++;
+
+    VirtualAddress page = page_align_down(addr);
+    populate(owner->page_table, page, flags);
+
+    // Fault-around: fill the rest of the window, clipped to the area
+    constexpr usize window = FAULT_AROUND_PAGES * PAGE_SIZE;
+    VirtualAddress start = page & ~(window - 1);
+    VirtualAddress end = start + window;
+    if (start < vma->start) start = vma->start;
+    if (end > vma->end) end = vma->end;
+
+    for (VirtualAddress virt = start; virt < end; virt += PAGE_SIZE) {
+        if (virt != page && AddressSpace::virt_to_phys(owner->page_table, virt) == 0) {
+            populate(owner->page_table, virt, flags);
+        }
+    }
+
+    return true;
+}
+
+void DemandPager::print_stats() {
+    drivers::kprintf("\n=== Demand Paging Statistics ===\n");
+    drivers::kprintf("Faults resolved: %u\n", faults_);
+    drivers::kprintf("Pages populated: %u (%u KB)\n",
+                    pages_populated_, pages_populated_ * PAGE_SIZE / 1024);
+    drivers::kprintf("\n");
+}
+
+void DemandPager::page_fault_handler(arch::x86_64::InterruptFrame* frame) {
+    uint64 cr2;
+    asm volatile("mov %%cr2, %0" : "=r"(cr2));
+
+    if (handle_fault(cr2, frame->err_code)) {
+        return;
+    }
+
+    drivers::kprintf("\n=== PAGE FAULT ===\n");
+    drivers::kprintf("Address: 0x%lx  Error: 0x%lx  RIP: 0x%lx\n",
+                    cr2, frame->err_code, frame->rip);
+    drivers::serial_printf("[DemandPager] Unhandled fault at 0x%lx (error 0x%lx, RIP 0x%lx)\n",
+                          cr2, frame->err_code, frame->rip);
+    kernel::panic("Unhandled page fault");
+}
+
+void DemandPager::populate(PageTable* pml4, VirtualAddress virt, uint64 flags) {
+    PhysicalAddress phys = PhysicalAllocator::allocate_frame();
+    memset(phys_to_virt(phys), 0, PAGE_SIZE);
+
+    AddressSpace::map_page(pml4, virt, phys, flags);
+    pages_populated_++;
+}
+
+} // namespace tiny_os::memory
@@ -1,59 +1,136 @@
 #include <tiny_os/memory/heap_allocator.h>
+#include <tiny_os/memory/heap_profiler.h>
+#include <tiny_os/memory/physical_allocator.h>
+#include <tiny_os/memory/virtual_allocator.h>
+#include <tiny_os/arch/x86_64/idt.h>
 #include <tiny_os/common/string.h>
 #include <tiny_os/drivers/vga.h>
 #include <tiny_os/drivers/serial.h>
 #include <tiny_os/kernel/kernel.h>
+#include <new>
 
 namespace tiny_os::memory {
 
-HeapBlockHeader* HeapAllocator::free_list_head_ = nullptr;
+uint64 HeapAllocator::fl_bitmap_ = 0;
+uint32 HeapAllocator::sl_bitmap_[FL_INDEX_COUNT] = {};
+HeapBlockHeader* HeapAllocator::free_lists_[FL_INDEX_COUNT][SL_INDEX_COUNT] = {};
 VirtualAddress HeapAllocator::heap_start_ = 0;
-usize HeapAllocator::heap_size_ = 0;
+VirtualAddress HeapAllocator::heap_end_ = 0;
+VirtualAddress HeapAllocator::heap_limit_ = 0;
 usize HeapAllocator::used_bytes_ = 0;
 
-void HeapAllocator::init(VirtualAddress start, usize size) {
+namespace {
+
+// Index of the highest set bit
+inline usize fls(usize value) {
+    return 63 - __builtin_clzll(value);
+}
+
+inline usize block_size(const HeapBlockHeader* block) {
+    return block->size & ~HeapBlockHeader::FLAG_MASK;
+}
+
+inline HeapBlockHeader* block_at(void* base, usize offset) {
+    return reinterpret_cast<HeapBlockHeader*>(static_cast<uint8*>(base) + offset);
+}
+
+} // namespace
+
+void HeapAllocator::init(VirtualAddress start, usize max_size) {
     drivers::kprintf("\nInitializing kernel heap...\n");
-    drivers::serial_printf("Heap init: start=0x%lx, size=%lu bytes\n", start, size);
+    drivers::serial_printf("Heap init: start=0x%lx, max size=%lu bytes\n", start, max_size);
+
+    // Blocks must stay below the largest size class
+    if (max_size > (1ULL << (FL_INDEX_MAX - 1))) {
+        max_size = 1ULL << (FL_INDEX_MAX - 1);
+    }
+    max_size &= ~(CHUNK_SIZE - 1);
+
+    if (max_size == 0 || !map_chunks(start, CHUNK_SIZE)) {
+        kernel::panic("Cannot set up the kernel heap");
+    }
 
     heap_start_ = start;
-    heap_size_ = size;
+    heap_end_ = start + CHUNK_SIZE;
+    heap_limit_ = start + max_size;
     used_bytes_ = 0;
 
-    // Initialize free list with one large block
-    free_list_head_ = reinterpret_cast<HeapBlockHeader*>(start);
-    free_list_head_->size = size;
-    free_list_head_->is_free = true;
-    free_list_head_->next = nullptr;
-    free_list_head_->magic = HeapBlockHeader::MAGIC_VALUE;
+    // A zero-sized used block at the end stops coalescing, so every block
+    // has a physical successor. Growing turns it into a free block.
+    usize usable = CHUNK_SIZE - HEADER_SIZE;
+    auto* first = reinterpret_cast<HeapBlockHeader*>(start);
+    HeapBlockHeader* sentinel = block_at(first, usable);
+    sentinel->size = 0;
+    sentinel->magic = HeapBlockHeader::MAGIC_VALUE;
+
+    first->size = 0;
+    mark_free(first, usable);
+    insert_free_block(first);
 
-    drivers::kprintf("Heap initialized: %u MB at 0x%x\n",
-                    size / (1024 * 1024), start);
+    drivers::kprintf("Heap initialized: %u MB at 0x%x, up to %u MB\n",
+                    CHUNK_SIZE / (1024 * 1024), start, max_size / (1024 * 1024));
     drivers::serial_printf("Heap ready\n");
 }
 
 void* HeapAllocator::kmalloc(usize size) {
-    if (size == 0) return nullptr;
+    return kmalloc_from(__builtin_return_address(0), size);
+}
 
-    // Align size to 16 bytes
-    size = (size + 15) & ~15;
+void* HeapAllocator::kmalloc_aligned(usize size, usize alignment) {
+    if (alignment == 0) return nullptr;
+    return kmalloc_from(__builtin_return_address(0), size, alignment);
+}
 
-    // Find suitable free block
-    HeapBlockHeader* block = find_free_block(size + sizeof(HeapBlockHeader));
-    if (!block) {
-        drivers::serial_printf("ERROR: kmalloc failed, size=%lu\n", size);
+void* HeapAllocator::kmalloc_from(const void* caller, usize size, usize alignment) {
+    if ((alignment & (alignment - 1)) != 0) return nullptr;
+    if (size == 0) return nullptr;
+    if (size > MAX_ALLOC_SIZE || alignment > MAX_ALLOC_SIZE) {
+        drivers::serial_printf("ERROR: kmalloc failed, size=%lu align=%lu\n", size, alignment);
         return nullptr;
     }
 
-    // Split block if it's much larger than needed
-    split_block(block, size + sizeof(HeapBlockHeader));
+    // Align size to 16 bytes and add the header
+    usize requested = size;
+    size = ((size + ALIGNMENT - 1) & ~(ALIGNMENT - 1)) + HEADER_SIZE;
+    if (size < MIN_BLOCK_SIZE) {
+        size = MIN_BLOCK_SIZE;
+    }
 
-    // Mark block as used
-    block->is_free = false;
-    used_bytes_ += block->size;
+    // An aligned block needs room to move its payload to an aligned
+    // address, leaving either no gap or one large enough to be a free block
+    bool aligned = alignment > ALIGNMENT;
+    usize search_size = aligned ? size + alignment + MIN_BLOCK_SIZE : size;
 
-    // Return pointer to data (after header)
-    return reinterpret_cast<void*>(
-        reinterpret_cast<uint8*>(block) + sizeof(HeapBlockHeader));
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    HeapBlockHeader* block = locate_free_block(search_size);
+    if (!block && grow(search_size)) {
+        block = locate_free_block(search_size);
+    }
+
+    void* ptr = nullptr;
+    if (block) {
+        if (aligned) {
+            block = align_block(block, alignment);
+        }
+        ptr = use_block(block, size);
+
+        if (HeapProfiler::enabled()) {
+            HeapProfiler::record_alloc(block, requested, block_size(block), caller);
+        }
+    }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+
+    if (!ptr) {
+        drivers::serial_printf("ERROR: kmalloc failed, size=%lu align=%lu\n", size, alignment);
+    }
+    return ptr;
 }
 
 void HeapAllocator::kfree(void* ptr) {
@@ -61,7 +138,7 @@ void HeapAllocator::kfree(void* ptr) {
 
     // Get block header
     auto* block = reinterpret_cast<HeapBlockHeader*>(
-        reinterpret_cast<uint8*>(ptr) - sizeof(HeapBlockHeader));
+        reinterpret_cast<uint8*>(ptr) - HEADER_SIZE);
 
     // Verify magic number
     if (block->magic != HeapBlockHeader::MAGIC_VALUE) {
@@ -70,40 +147,48 @@ void HeapAllocator::kfree(void* ptr) {
         kernel::panic("Heap corruption!");
     }
 
-    if (block->is_free) {
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    if (block->size & HeapBlockHeader::FREE) {
+        if (interrupts_enabled) {
+            arch::x86_64::IDT::enable_interrupts();
+        }
         drivers::serial_printf("WARNING: Double free at 0x%lx\n",
                               reinterpret_cast<uint64>(ptr));
         return;
     }
 
-    // Mark block as free
-    block->is_free = true;
-    used_bytes_ -= block->size;
-
-    // Merge with adjacent free blocks
-    merge_free_blocks();
-}
+    if (block->profile != 0) {
+        HeapProfiler::record_free(block, block_size(block));
+    }
 
-void* HeapAllocator::kmalloc_aligned(usize size, usize alignment) {
-    // Allocate extra space for alignment
-    void* ptr = kmalloc(size + alignment + sizeof(usize));
-    if (!ptr) return nullptr;
+    used_bytes_ -= block_size(block);
+    block = release_block(block);
 
-    // Calculate aligned address
-    usize addr = reinterpret_cast<usize>(ptr);
-    usize aligned_addr = (addr + alignment - 1) & ~(alignment - 1);
+    // Only the free block just before the sentinel can be trimmed
+    if (next_block(block) == reinterpret_cast<HeapBlockHeader*>(heap_end_ - HEADER_SIZE)) {
+        trim(block);
+    }
 
-    // Store original pointer before aligned address
-    if (aligned_addr == addr) {
-        aligned_addr += alignment;
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
     }
-    *reinterpret_cast<usize*>(aligned_addr - sizeof(usize)) = addr;
+}
 
-    return reinterpret_cast<void*>(aligned_addr);
+bool HeapAllocator::contains(const void* ptr) {
+    VirtualAddress addr = reinterpret_cast<VirtualAddress>(ptr);
+    return addr >= heap_start_ && addr < heap_end_;
 }
 
 usize HeapAllocator::total_size() {
-    return heap_size_;
+    return heap_end_ - heap_start_;
+}
+
+usize HeapAllocator::reserved_size() {
+    return heap_limit_ - heap_start_;
 }
 
 usize HeapAllocator::used_size() {
@@ -111,91 +196,353 @@ usize HeapAllocator::used_size() {
 }
 
 usize HeapAllocator::free_size() {
-    return heap_size_ - used_bytes_;
+    return total_size() - used_bytes_;
+}
+
+usize HeapAllocator::largest_free_block() {
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    // Only the highest non-empty list can hold the largest block
+    usize largest = 0;
+    if (fl_bitmap_) {
+        usize fl = fls(fl_bitmap_);
+        usize sl = fls(sl_bitmap_[fl]);
+        for (HeapBlockHeader* block = free_lists_[fl][sl]; block; block = block->next_free) {
+            if (block_size(block) > largest) {
+                largest = block_size(block);
+            }
+        }
+    }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+
+    return largest ? largest - HEADER_SIZE : 0;
 }
 
 void HeapAllocator::print_stats() {
     drivers::kprintf("\n=== Heap Statistics ===\n");
-    drivers::kprintf("Total size: %u KB\n", heap_size_ / 1024);
+    drivers::kprintf("Total size: %u KB\n", total_size() / 1024);
+    drivers::kprintf("Reserved:   %u MB\n", reserved_size() / (1024 * 1024));
     drivers::kprintf("Used:       %u KB\n", used_bytes_ / 1024);
     drivers::kprintf("Free:       %u KB\n", free_size() / 1024);
+    drivers::kprintf("Largest:    %u KB\n", largest_free_block() / 1024);
     drivers::kprintf("Usage:      %u%%\n",
-                    (used_bytes_ * 100) / heap_size_);
+                    (used_bytes_ * 100) / total_size());
 
     drivers::serial_printf("Heap: %lu KB used / %lu KB total\n",
                           used_bytes_ / 1024,
-                          heap_size_ / 1024);
+                          total_size() / 1024);
+}
+
+void HeapAllocator::mapping_insert(usize size, usize& fl, usize& sl) {
+    if (size < SMALL_BLOCK_SIZE) {
+        fl = 0;
+        sl = size / (SMALL_BLOCK_SIZE / SL_INDEX_COUNT);
+    } else {
+        usize bit = fls(size);
+        fl = bit - (FL_INDEX_SHIFT - 1);
+        sl = (size >> (bit - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+    }
+}
+
+void HeapAllocator::mapping_search(usize size, usize& fl, usize& sl) {
+    // Round up to the next list boundary so the first block found fits
+    if (size >= SMALL_BLOCK_SIZE) {
+        size += (1ULL << (fls(size) - SL_INDEX_COUNT_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
 }
 
-void HeapAllocator::merge_free_blocks() {
-    HeapBlockHeader* current = free_list_head_;
+HeapBlockHeader* HeapAllocator::find_suitable_block(usize& fl, usize& sl) {
+    uint32 sl_map = sl_bitmap_[fl] & (~0U << sl);
+    if (!sl_map) {
+        uint64 fl_map = fl_bitmap_ & (~0ULL << (fl + 1));
+        if (!fl_map) return nullptr;
 
-    while (current && current->next) {
-        if (current->is_free && current->next->is_free) {
-            // Check if blocks are adjacent
-            uint8* current_end = reinterpret_cast<uint8*>(current) + current->size;
-            if (current_end == reinterpret_cast<uint8*>(current->next)) {
-                // Merge blocks
-                current->size += current->next->size;
-                current->next = current->next->next;
-                continue;  // Check again with same block
+        fl = __builtin_ctzll(fl_map);
+        sl_map = sl_bitmap_[fl];
+    }
+
+    sl = __builtin_ctz(sl_map);
+    return free_lists_[fl][sl];
+}
+
+HeapBlockHeader* HeapAllocator::locate_free_block(usize size) {
+    // The head of the block's own class often fits; taking it avoids
+    // splitting a larger block
+    usize fl, sl;
+    mapping_insert(size, fl, sl);
+    HeapBlockHeader* block = free_lists_[fl][sl];
+
+    if (!block || block_size(block) < size) {
+        mapping_search(size, fl, sl);
+        block = find_suitable_block(fl, sl);
+    }
+
+    if (block) {
+        remove_free_block(block);
+    }
+    return block;
+}
+
+void HeapAllocator::insert_free_block(HeapBlockHeader* block) {
+    usize fl, sl;
+    mapping_insert(block_size(block), fl, sl);
+
+    HeapBlockHeader* head = free_lists_[fl][sl];
+    block->next_free = head;
+    block->prev_free = nullptr;
+    if (head) {
+        head->prev_free = block;
+    }
+    free_lists_[fl][sl] = block;
+
+    fl_bitmap_ |= 1ULL << fl;
+    sl_bitmap_[fl] |= 1U << sl;
+}
+
+void HeapAllocator::remove_free_block(HeapBlockHeader* block) {
+    usize fl, sl;
+    mapping_insert(block_size(block), fl, sl);
+
+    if (block->next_free) {
+        block->next_free->prev_free = block->prev_free;
+    }
+    if (block->prev_free) {
+        block->prev_free->next_free = block->next_free;
+    } else {
+        free_lists_[fl][sl] = block->next_free;
+        if (!free_lists_[fl][sl]) {
+            sl_bitmap_[fl] &= ~(1U << sl);
+            if (!sl_bitmap_[fl]) {
+                fl_bitmap_ &= ~(1ULL << fl);
             }
         }
-        current = current->next;
     }
 }
 
-HeapBlockHeader* HeapAllocator::find_free_block(usize size) {
-    HeapBlockHeader* current = free_list_head_;
+void* HeapAllocator::use_block(HeapBlockHeader* block, usize size) {
+    usize available = block_size(block);
+    usize prev_free = block->size & HeapBlockHeader::PREV_FREE;
 
-    while (current) {
-        if (current->is_free && current->size >= size) {
-            return current;
-        }
-        current = current->next;
+    if (available - size >= MIN_BLOCK_SIZE) {
+        // Return the tail as a new free block
+        HeapBlockHeader* remainder = block_at(block, size);
+        remainder->size = 0;
+        mark_free(remainder, available - size);
+        insert_free_block(remainder);
+    } else {
+        size = available;
+        next_block(block)->size &= ~HeapBlockHeader::PREV_FREE;
     }
 
-    return nullptr;
+    block->size = size | prev_free;
+    block->magic = HeapBlockHeader::MAGIC_VALUE;
+    block->profile = 0;
+    used_bytes_ += size;
+
+    return reinterpret_cast<uint8*>(block) + HEADER_SIZE;
 }
 
-void HeapAllocator::split_block(HeapBlockHeader* block, usize size) {
-    if (block->size < size + MIN_BLOCK_SIZE) {
-        // Block is not large enough to split
-        return;
+HeapBlockHeader* HeapAllocator::next_block(HeapBlockHeader* block) {
+    return block_at(block, block_size(block));
+}
+
+HeapBlockHeader* HeapAllocator::prev_block(HeapBlockHeader* block) {
+    // Boundary tag: a free block's size is in its last word
+    usize prev_size = *(reinterpret_cast<usize*>(block) - 1);
+    return reinterpret_cast<HeapBlockHeader*>(reinterpret_cast<uint8*>(block) - prev_size);
+}
+
+void HeapAllocator::mark_free(HeapBlockHeader* block, usize size) {
+    block->size = size | HeapBlockHeader::FREE |
+                  (block->size & HeapBlockHeader::PREV_FREE);
+    block->magic = HeapBlockHeader::MAGIC_VALUE;
+
+    *reinterpret_cast<usize*>(reinterpret_cast<uint8*>(block) + size - sizeof(usize)) = size;
+    next_block(block)->size |= HeapBlockHeader::PREV_FREE;
+}
+
+HeapBlockHeader* HeapAllocator::align_block(HeapBlockHeader* block, usize alignment) {
+    VirtualAddress start = reinterpret_cast<VirtualAddress>(block);
+    VirtualAddress payload = (start + HEADER_SIZE + alignment - 1) & ~(alignment - 1);
+    usize gap = payload - HEADER_SIZE - start;
+    if (gap != 0 && gap < MIN_BLOCK_SIZE) {
+        gap += alignment;
     }
+    if (gap == 0) return block;
 
-    // Create new free block from remainder
-    auto* new_block = reinterpret_cast<HeapBlockHeader*>(
-        reinterpret_cast<uint8*>(block) + size);
+    // Split the prefix off as a free block of its own; its previous
+    // neighbour is in use, as free blocks are always coalesced
+    HeapBlockHeader* aligned = block_at(block, gap);
+    aligned->size = block_size(block) - gap;
+    mark_free(block, gap);
+    insert_free_block(block);
 
-    new_block->size = block->size - size;
-    new_block->is_free = true;
-    new_block->next = block->next;
-    new_block->magic = HeapBlockHeader::MAGIC_VALUE;
+    return aligned;
+}
+
+HeapBlockHeader* HeapAllocator::release_block(HeapBlockHeader* block) {
+    usize size = block_size(block);
+
+    // Flag the header even if it is absorbed below, so a second kfree of
+    // the same pointer is still reported
+    block->size |= HeapBlockHeader::FREE;
+
+    // Merge with free physical neighbours
+    HeapBlockHeader* next = next_block(block);
+    if (block->size & HeapBlockHeader::PREV_FREE) {
+        HeapBlockHeader* prev = prev_block(block);
+        remove_free_block(prev);
+        size += block_size(prev);
+        block = prev;
+    }
+    if (next->size & HeapBlockHeader::FREE) {
+        remove_free_block(next);
+        size += block_size(next);
+    }
 
-    block->size = size;
-    block->next = new_block;
+    mark_free(block, size);
+    insert_free_block(block);
+    return block;
+}
+
+bool HeapAllocator::grow(usize size) {
+    auto* sentinel = reinterpret_cast<HeapBlockHeader*>(heap_end_ - HEADER_SIZE);
+
+    // A free last block is extended instead of starting a new one
+    usize tail = 0;
+    if (sentinel->size & HeapBlockHeader::PREV_FREE) {
+        tail = block_size(prev_block(sentinel));
+    }
+    usize needed = size > tail ? size - tail : MIN_BLOCK_SIZE;
+    usize length = (needed + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+
+    if (length > heap_limit_ - heap_end_ || !map_chunks(heap_end_, length)) {
+        return false;
+    }
+
+    // The old sentinel becomes the header of the new space and is freed
+    // into the last block like any other block
+    HeapBlockHeader* new_sentinel = block_at(sentinel, length);
+    new_sentinel->size = 0;
+    new_sentinel->magic = HeapBlockHeader::MAGIC_VALUE;
+
+    sentinel->size = length | (sentinel->size & HeapBlockHeader::PREV_FREE);
+    heap_end_ += length;
+    release_block(sentinel);
+
+    return true;
+}
+
+void HeapAllocator::trim(HeapBlockHeader* block) {
+    VirtualAddress start = reinterpret_cast<VirtualAddress>(block);
+
+    // Keep the block's first chunk plus a spare one, so a workload
+    // hovering around a chunk boundary does not map and unmap every time
+    VirtualAddress keep = ((start + MIN_BLOCK_SIZE + HEADER_SIZE + CHUNK_SIZE - 1) &
+                           ~(CHUNK_SIZE - 1)) + CHUNK_SIZE;
+    if (keep >= heap_end_ || heap_end_ - keep < TRIM_THRESHOLD) return;
+
+    remove_free_block(block);
+
+    HeapBlockHeader* sentinel = block_at(block, keep - HEADER_SIZE - start);
+    sentinel->size = 0;
+    sentinel->magic = HeapBlockHeader::MAGIC_VALUE;
+
+    block->size &= HeapBlockHeader::FLAG_MASK;
+    mark_free(block, keep - HEADER_SIZE - start);
+    insert_free_block(block);
+
+    unmap_chunks(keep, heap_end_ - keep);
+    heap_end_ = keep;
+}
+
+bool HeapAllocator::map_chunks(VirtualAddress start, usize length) {
+    uint64 flags = PageFlags::PRESENT | PageFlags::WRITABLE | VirtualAllocator::nx_flag();
+
+    if (PhysicalAllocator::free_frames() < length / PAGE_SIZE) {
+        return false;
+    }
+
+    for (usize offset = 0; offset < length; offset += CHUNK_SIZE) {
+        // A contiguous 2MB block maps with one huge page
+        PhysicalAddress phys = PhysicalAllocator::try_allocate_frames(CHUNK_SIZE / PAGE_SIZE);
+        if (phys) {
+            VirtualAllocator::map_range(start + offset, phys, CHUNK_SIZE, flags);
+            continue;
+        }
+
+        // Fragmented memory: back the chunk with single frames
+        for (usize page = 0; page < CHUNK_SIZE; page += PAGE_SIZE) {
+            VirtualAllocator::map_page(start + offset + page,
+                                       PhysicalAllocator::allocate_frame(), flags);
+        }
+    }
+
+    return true;
+}
+
+void HeapAllocator::unmap_chunks(VirtualAddress start, usize length) {
+    // Free physically contiguous runs in one call each
+    PhysicalAddress run_phys = 0;
+    usize run_length = 0;
+
+    for (usize offset = 0; offset < length; offset += PAGE_SIZE) {
+        PhysicalAddress phys = VirtualAllocator::virt_to_phys(start + offset);
+
+        if (run_length != 0 && phys == run_phys + run_length) {
+            run_length += PAGE_SIZE;
+            continue;
+        }
+
+        if (run_length != 0) {
+            PhysicalAllocator::free_frames(run_phys, run_length / PAGE_SIZE);
+        }
+        run_phys = phys;
+        run_length = PAGE_SIZE;
+    }
+    PhysicalAllocator::free_frames(run_phys, run_length / PAGE_SIZE);
+
+    VirtualAllocator::unmap_range(start, length);
 }
 
 } // namespace tiny_os::memory
 
-// Update global operator new/delete to use real heap allocator
-void* operator new(usize size) {
+// Defined in new.cpp
+extern "C" void* tiny_os_early_malloc(size_t size);
+
+namespace {
+
+// Allocations are charged to the caller of operator new
+void* heap_new(size_t size, const void* caller) {
     if (tiny_os::memory::HeapAllocator::total_size() > 0) {
-        return tiny_os::memory::HeapAllocator::kmalloc(size);
+        return tiny_os::memory::HeapAllocator::kmalloc_from(caller, size);
     } else {
         // Fall back to early allocator if heap not initialized
-        extern void* tiny_os_early_malloc(usize);
         return tiny_os_early_malloc(size);
     }
 }
 
+} // namespace
+
+// Update global operator new/delete to use real heap allocator
+void* operator new(usize size) {
+    return heap_new(size, __builtin_return_address(0));
+}
+
 void* operator new[](usize size) {
-    return operator new(size);
+    return heap_new(size, __builtin_return_address(0));
 }
 
 void operator delete(void* ptr) noexcept {
-    if (tiny_os::memory::HeapAllocator::total_size() > 0) {
+    // Early boot allocations are never freed
+    if (tiny_os::memory::HeapAllocator::contains(ptr)) {
         tiny_os::memory::HeapAllocator::kfree(ptr);
     }
 }
@@ -211,3 +558,30 @@ void operator delete(void* ptr, usize) noexcept {
 void operator delete[](void* ptr, usize) noexcept {
     operator delete(ptr);
 }
+
+// Over-aligned types (alignas above 16) come straight from kmalloc_aligned
+void* operator new(size_t size, std::align_val_t alignment) {
+    return tiny_os::memory::HeapAllocator::kmalloc_from(
+        __builtin_return_address(0), size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return tiny_os::memory::HeapAllocator::kmalloc_from(
+        __builtin_return_address(0), size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+    operator delete(ptr);
+}
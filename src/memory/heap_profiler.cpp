@@ -0,0 +1,170 @@
+#include <tiny_os/memory/heap_profiler.h>
+#include <tiny_os/memory/heap_allocator.h>
+#include <tiny_os/arch/x86_64/idt.h>
+#include <tiny_os/drivers/serial.h>
+#include <tiny_os/drivers/timer.h>
+
+namespace tiny_os::memory {
+
+bool HeapProfiler::enabled_ = false;
+HeapCallSite HeapProfiler::sites_[MAX_SITES] = {};
+usize HeapProfiler::site_count_ = 0;
+uint64 HeapProfiler::allocs_ = 0;
+uint64 HeapProfiler::frees_ = 0;
+usize HeapProfiler::live_bytes_ = 0;
+usize HeapProfiler::peak_bytes_ = 0;
+
+namespace {
+
+// Histogram bucket: <= 32 bytes, <= 64 bytes, ... everything larger in the last
+usize size_class(usize size) {
+    usize bucket = 0;
+    for (usize limit = 32; size > limit && bucket < HeapCallSite::SIZE_CLASSES - 1; limit <<= 1) {
+        bucket++;
+    }
+    return bucket;
+}
+
+} // namespace
+
+void HeapProfiler::enable() {
+    enabled_ = true;
+    drivers::serial_printf("[HeapProf] Tracking heap allocations\n");
+}
+
+void HeapProfiler::disable() {
+    enabled_ = false;
+}
+
+void HeapProfiler::record_alloc(HeapBlockHeader* block, usize requested, usize size,
+                                const void* caller) {
+    usize index = site_for(caller);
+    HeapCallSite& site = sites_[index];
+
+    site.allocs++;
+    site.size_classes[size_class(requested)]++;
+    site.live_bytes += size;
+    if (site.live_bytes > site.peak_bytes) {
+        site.peak_bytes = site.live_bytes;
+    }
+
+    allocs_++;
+    live_bytes_ += size;
+    if (live_bytes_ > peak_bytes_) {
+        peak_bytes_ = live_bytes_;
+    }
+
+    uint32 birth = static_cast<uint32>(drivers::Timer::get_ticks()) & BIRTH_MASK;
+    block->profile = static_cast<uint32>(index + 1) | (birth << BIRTH_SHIFT);
+}
+
+void HeapProfiler::record_free(HeapBlockHeader* block, usize size) {
+    uint32 tag = block->profile & TAG_MASK;
+    if (tag == 0) return;
+
+    HeapCallSite& site = sites_[tag - 1];
+
+    // Lifetimes are kept modulo 2^24 ticks (about 46 hours at 100Hz)
+    uint32 birth = block->profile >> BIRTH_SHIFT;
+    block->profile = 0;
+    uint32 now = static_cast<uint32>(drivers::Timer::get_ticks()) & BIRTH_MASK;
+    uint64 lifetime = (now - birth) & BIRTH_MASK;
+
+    site.frees++;
+    site.live_bytes -= size;
+    site.lifetime_ticks += lifetime;
+    if (lifetime > site.max_lifetime_ticks) {
+        site.max_lifetime_ticks = lifetime;
+    }
+
+    frees_++;
+    live_bytes_ -= size;
+}
+
+void HeapProfiler::report() {
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    usize free = HeapAllocator::free_size();
+    usize largest = HeapAllocator::largest_free_block();
+
+    drivers::serial_printf("[HeapProf] allocs=%lu frees=%lu live=%lu peak=%lu sites=%lu\n",
+                          allocs_, frees_, live_bytes_, peak_bytes_, site_count_);
+    drivers::serial_printf("[HeapProf] heap mapped=%lu used=%lu free=%lu largest_free=%lu "
+                          "fragmentation=%lu%%\n",
+                          HeapAllocator::total_size(), HeapAllocator::used_size(), free,
+                          largest, free ? 100 - (largest * 100) / free : 0);
+
+    // Order sites by peak bytes (insertion sort; the table is small)
+    uint8 order[MAX_SITES];
+    usize count = 0;
+    for (usize i = 0; i < MAX_SITES; i++) {
+        if (sites_[i].allocs == 0) continue;
+
+        usize j = count++;
+        while (j > 0 && sites_[order[j - 1]].peak_bytes < sites_[i].peak_bytes) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = static_cast<uint8>(i);
+    }
+
+    for (usize i = 0; i < count; i++) {
+        const HeapCallSite& site = sites_[order[i]];
+
+        if (order[i] == OVERFLOW_SITE) {
+            drivers::serial_printf("[HeapProf] site other:");
+        } else {
+            drivers::serial_printf("[HeapProf] site 0x%lx:",
+                                  reinterpret_cast<uint64>(site.caller));
+        }
+        drivers::serial_printf(" allocs=%lu frees=%lu live=%lu peak=%lu",
+                              site.allocs, site.frees, site.live_bytes, site.peak_bytes);
+        if (site.frees != 0) {
+            drivers::serial_printf(" life_avg=%lu life_max=%lu ticks",
+                                  site.lifetime_ticks / site.frees, site.max_lifetime_ticks);
+        }
+        drivers::serial_printf("\n[HeapProf]   sizes");
+        for (usize bucket = 0; bucket < HeapCallSite::SIZE_CLASSES; bucket++) {
+            if (site.size_classes[bucket] == 0) continue;
+
+            if (bucket == HeapCallSite::SIZE_CLASSES - 1) {
+                drivers::serial_printf(" >%lu:%u", 32UL << (bucket - 1),
+                                      site.size_classes[bucket]);
+            } else {
+                drivers::serial_printf(" <=%lu:%u", 32UL << bucket,
+                                      site.size_classes[bucket]);
+            }
+        }
+        drivers::serial_printf("\n");
+    }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+}
+
+usize HeapProfiler::site_for(const void* caller) {
+    // Open addressing on the return address over all but the overflow site
+    usize slots = MAX_SITES - 1;
+    usize index = (reinterpret_cast<uintptr_t>(caller) >> 2) % slots;
+
+    for (usize probe = 0; probe < slots; probe++) {
+        HeapCallSite& site = sites_[index];
+        if (site.caller == caller && site.allocs != 0) {
+            return index;
+        }
+        if (site.allocs == 0) {
+            site.caller = caller;
+            site_count_++;
+            return index;
+        }
+        index = (index + 1) % slots;
+    }
+
+    return OVERFLOW_SITE;
+}
+
+} // namespace tiny_os::memory
@@ -0,0 +1,156 @@
+#include <tiny_os/memory/kernel_stack.h>
+#include <tiny_os/memory/vmalloc.h>
+#include <tiny_os/memory/physical_allocator.h>
+#include <tiny_os/memory/virtual_allocator.h>
+#include <tiny_os/arch/x86_64/idt.h>
+#include <tiny_os/drivers/vga.h>
+#include <tiny_os/drivers/serial.h>
+#include <tiny_os/kernel/kernel.h>
+
+namespace tiny_os::memory {
+
+VirtualAddress KernelStack::base_ = 0;
+uint64 KernelStack::slots_[MAX_STACKS / 64] = {};
+usize KernelStack::cursor_ = 0;
+usize KernelStack::mapped_ = 0;
+usize KernelStack::in_use_ = 0;
+StackCache KernelStack::caches_[arch::x86_64::CPU::MAX_CPUS] = {};
+
+namespace {
+
+constexpr usize SLOT_WORDS = KernelStack::MAX_STACKS / 64;
+constexpr usize STACK_PAGES = KernelStack::STACK_SIZE / PAGE_SIZE;
+
+} // namespace
+
+void KernelStack::init() {
+    // Address space only; page tables appear as slots get backed
+    base_ = Vmalloc::reserve(MAX_STACKS * SLOT_SIZE);
+    if (!base_) {
+        kernel::panic("Cannot reserve the kernel stack region!");
+    }
+
+    drivers::serial_printf("[KStack] %lu slots of %lu bytes at 0x%lx\n",
+                          MAX_STACKS, SLOT_SIZE, base_);
+}
+
+VirtualAddress KernelStack::allocate() {
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    StackCache& cache = caches_[arch::x86_64::CPU::current_index()];
+
+    VirtualAddress bottom;
+    if (cache.count > 0) {
+        bottom = cache.stacks[--cache.count];
+        cache.hits++;
+    } else {
+        bottom = map_slot();
+        cache.misses++;
+    }
+
+    if (bottom) {
+        in_use_++;
+    }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+
+    return bottom;
+}
+
+void KernelStack::free(VirtualAddress bottom) {
+    if (!bottom) return;
+
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    in_use_--;
+
+    StackCache& cache = caches_[arch::x86_64::CPU::current_index()];
+    if (cache.count < StackCache::SIZE) {
+        cache.stacks[cache.count++] = bottom;
+    } else {
+        unmap_slot(bottom);
+    }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+}
+
+void KernelStack::print_stats() {
+    uint64 hits = 0;
+    uint64 misses = 0;
+    usize cached = 0;
+    for (const StackCache& cache : caches_) {
+        hits += cache.hits;
+        misses += cache.misses;
+        cached += cache.count;
+    }
+
+    drivers::kprintf("\n=== Kernel Stack Statistics ===\n");
+    drivers::kprintf("In use:       %u\n", in_use_);
+    drivers::kprintf("Cached:       %u\n", cached);
+    drivers::kprintf("Mapped:       %u KB\n", mapped_ * STACK_SIZE / 1024);
+    drivers::kprintf("Cache hits:   %u\n", hits);
+    drivers::kprintf("Cache misses: %u\n", misses);
+
+    drivers::serial_printf("KStack: %lu in use, %lu cached, %lu mapped, %lu hits, %lu misses\n",
+                          in_use_, cached, mapped_, hits, misses);
+}
+
+VirtualAddress KernelStack::map_slot() {
+    // First free slot from the cursor on, wrapping around once
+    for (usize n = 0; n < SLOT_WORDS; n++) {
+        usize word = (cursor_ + n) % SLOT_WORDS;
+        if (slots_[word] == ~0ULL) continue;
+
+        usize bit = __builtin_ctzll(~slots_[word]);
+        slots_[word] |= 1ULL << bit;
+        cursor_ = word;
+
+        // The guard page at the start of the slot stays unmapped
+        usize slot = word * 64 + bit;
+        VirtualAddress bottom = base_ + slot * SLOT_SIZE + GUARD_SIZE;
+        for (usize page = 0; page < STACK_PAGES; page++) {
+            VirtualAllocator::map_page(bottom + page * PAGE_SIZE,
+                                       PhysicalAllocator::allocate_frame(),
+                                       PageFlags::PRESENT | PageFlags::WRITABLE |
+                                       VirtualAllocator::nx_flag());
+        }
+        mapped_++;
+
+        return bottom;
+    }
+
+    drivers::serial_printf("[KStack] Out of stack slots\n");
+    return 0;
+}
+
+void KernelStack::unmap_slot(VirtualAddress bottom) {
+    PhysicalAddress frames[STACK_PAGES];
+    for (usize page = 0; page < STACK_PAGES; page++) {
+        frames[page] = VirtualAllocator::virt_to_phys(bottom + page * PAGE_SIZE);
+    }
+
+    // Flushed right away: the slot can be handed out again at once
+    VirtualAllocator::unmap_range(bottom, STACK_SIZE);
+    for (usize page = 0; page < STACK_PAGES; page++) {
+        PhysicalAllocator::free_frame(frames[page]);
+    }
+    mapped_--;
+
+    usize slot = (bottom - base_) / SLOT_SIZE;
+    slots_[slot / 64] &= ~(1ULL << (slot % 64));
+    if (slot / 64 < cursor_) {
+        cursor_ = slot / 64;
+    }
+}
+
+} // namespace tiny_os::memory
@@ -0,0 +1,252 @@
+#include <tiny_os/memory/memblock.h>
+#include <tiny_os/memory/physmap.h>
+#include <tiny_os/common/multiboot2.h>
+#include <tiny_os/drivers/serial.h>
+#include <tiny_os/kernel/kernel.h>
+
+namespace tiny_os::memory {
+
+MemblockType Memblock::memory_ = {};
+MemblockType Memblock::reserved_ = {};
+bool Memblock::active_ = false;
+
+// External symbol from linker script
+extern "C" uint8 kernel_physical_end;
+
+namespace {
+
+// Real-mode IVT, BIOS data, VGA memory and ROMs
+constexpr PhysicalAddress LOW_MEMORY_END = 0x100000;
+
+// Load address of the kernel image (KERNEL_PHYSICAL_BASE in linker.ld)
+constexpr PhysicalAddress KERNEL_PHYSICAL_BASE = 0x100000;
+
+} // namespace
+
+template <typename Fn>
+void Memblock::for_each_free_range(Fn fn) {
+    usize r = 0;
+    for (usize m = 0; m < memory_.count; m++) {
+        PhysicalAddress start = memory_.regions[m].base;
+        PhysicalAddress end = start + memory_.regions[m].size;
+
+        // Skip reservations that end before this region
+        while (r < reserved_.count &&
+               reserved_.regions[r].base + reserved_.regions[r].size <= start) {
+            r++;
+        }
+
+        for (usize k = r; start < end; k++) {
+            if (k == reserved_.count || reserved_.regions[k].base >= end) {
+                fn(start, end);
+                break;
+            }
+
+            const MemblockRegion& reservation = reserved_.regions[k];
+            if (reservation.base > start) {
+                fn(start, reservation.base);
+            }
+            if (reservation.base + reservation.size > start) {
+                start = reservation.base + reservation.size;
+            }
+        }
+    }
+}
+
+void Memblock::init(void* multiboot_info) {
+    Multiboot2::parse(multiboot_info);
+
+    auto* mmap_tag = reinterpret_cast<const MultibootTagMmap*>(
+        Multiboot2::find_tag(MultibootTagType::MMAP));
+
+    if (!mmap_tag) {
+        kernel::panic("No memory map found!");
+    }
+
+    const auto* entry = reinterpret_cast<const MultibootMmapEntry*>(
+        reinterpret_cast<const uint8*>(mmap_tag) + sizeof(MultibootTagMmap));
+
+    const uint8* end = reinterpret_cast<const uint8*>(mmap_tag) + mmap_tag->size;
+
+    // Usable memory, shrunk to whole frames
+    for (; reinterpret_cast<const uint8*>(entry) < end;
+         entry = reinterpret_cast<const MultibootMmapEntry*>(
+             reinterpret_cast<const uint8*>(entry) + mmap_tag->entry_size)) {
+        if (entry->type != static_cast<uint32>(MemoryType::AVAILABLE)) continue;
+
+        PhysicalAddress first = page_align_up(entry->addr);
+        PhysicalAddress last = page_align_down(entry->addr + entry->len);
+        if (first < last) {
+            add_range(memory_, first, last);
+        }
+    }
+
+    reserve(0, LOW_MEMORY_END);
+
+    // The image includes the boot page tables and stack
+    PhysicalAddress kernel_end = reinterpret_cast<PhysicalAddress>(&kernel_physical_end);
+    reserve(KERNEL_PHYSICAL_BASE, kernel_end - KERNEL_PHYSICAL_BASE);
+
+    // The boot information stays readable (command line, ACPI RSDP)
+    reserve(virt_to_phys(multiboot_info), *reinterpret_cast<uint32*>(multiboot_info));
+
+    for (auto* tag = Multiboot2::find_tag(MultibootTagType::MODULE); tag;
+         tag = Multiboot2::find_tag(MultibootTagType::MODULE, tag)) {
+        auto* module = reinterpret_cast<const MultibootTagModule*>(tag);
+        reserve(module->mod_start, module->mod_end - module->mod_start);
+    }
+
+    active_ = true;
+    print_regions();
+}
+
+void Memblock::reserve(PhysicalAddress base, usize size) {
+    if (size == 0) return;
+    add_range(reserved_, page_align_down(base), page_align_up(base + size));
+}
+
+void Memblock::free(PhysicalAddress base, usize size) {
+    if (size == 0) return;
+    remove_range(reserved_, page_align_down(base), page_align_up(base + size));
+}
+
+PhysicalAddress Memblock::alloc(usize size, usize alignment) {
+    if (!active_) {
+        kernel::panic("Memblock: allocation outside early boot!");
+    }
+
+    size = page_align_up(size);
+    if (alignment < PAGE_SIZE) {
+        alignment = PAGE_SIZE;
+    }
+
+    // Highest fit below the boot mapping limit; the low 1MB is reserved,
+    // so 0 means nothing fits
+    PhysicalAddress found = 0;
+    for_each_free_range([&](PhysicalAddress start, PhysicalAddress end) {
+        if (end > BOOT_MAPPED_LIMIT) end = BOOT_MAPPED_LIMIT;
+        if (end <= start || end - start < size) return;
+
+        PhysicalAddress candidate = (end - size) & ~(alignment - 1);
+        if (candidate >= start && candidate > found) {
+            found = candidate;
+        }
+    });
+
+    if (found == 0) {
+        kernel::panic("Memblock: out of early memory!");
+    }
+
+    add_range(reserved_, found, found + size);
+    return found;
+}
+
+void Memblock::hand_over(void (*release)(PhysicalAddress start, PhysicalAddress end)) {
+    usize released = 0;
+    for_each_free_range([&](PhysicalAddress start, PhysicalAddress end) {
+        release(start, end);
+        released += end - start;
+    });
+    active_ = false;
+
+    drivers::serial_printf("Memblock: handed over %lu KB, %lu KB stays reserved\n",
+                          released / 1024, (memory_size() - released) / 1024);
+}
+
+usize Memblock::memory_size() {
+    usize total = 0;
+    for (usize i = 0; i < memory_.count; i++) {
+        total += memory_.regions[i].size;
+    }
+    return total;
+}
+
+PhysicalAddress Memblock::memory_end() {
+    if (memory_.count == 0) return 0;
+
+    const MemblockRegion& last = memory_.regions[memory_.count - 1];
+    return last.base + last.size;
+}
+
+void Memblock::print_regions() {
+    drivers::serial_printf("Memblock memory: %lu regions, %lu KB\n",
+                          memory_.count, memory_size() / 1024);
+    for (usize i = 0; i < memory_.count; i++) {
+        drivers::serial_printf("  0x%lx - 0x%lx\n", memory_.regions[i].base,
+                              memory_.regions[i].base + memory_.regions[i].size);
+    }
+
+    drivers::serial_printf("Memblock reserved: %lu regions\n", reserved_.count);
+    for (usize i = 0; i < reserved_.count; i++) {
+        drivers::serial_printf("  0x%lx - 0x%lx\n", reserved_.regions[i].base,
+                              reserved_.regions[i].base + reserved_.regions[i].size);
+    }
+}
+
+void Memblock::add_range(MemblockType& type, PhysicalAddress base, PhysicalAddress end) {
+    // Regions before the new range that do not touch it stay as they are
+    usize first = 0;
+    while (first < type.count &&
+           type.regions[first].base + type.regions[first].size < base) {
+        first++;
+    }
+
+    // Absorb every region that overlaps or touches it
+    usize last = first;
+    while (last < type.count && type.regions[last].base <= end) {
+        PhysicalAddress region_end = type.regions[last].base + type.regions[last].size;
+        if (type.regions[last].base < base) base = type.regions[last].base;
+        if (region_end > end) end = region_end;
+        last++;
+    }
+
+    if (last == first) {
+        // Nothing absorbed: open a slot
+        if (type.count == MemblockType::MAX_REGIONS) {
+            kernel::panic("Memblock: too many regions!");
+        }
+        for (usize i = type.count; i > first; i--) {
+            type.regions[i] = type.regions[i - 1];
+        }
+        type.count++;
+    } else {
+        // Close the gap left by the absorbed regions beyond the first
+        usize removed = last - first - 1;
+        for (usize i = first + 1; i + removed < type.count; i++) {
+            type.regions[i] = type.regions[i + removed];
+        }
+        type.count -= removed;
+    }
+
+    type.regions[first] = MemblockRegion{base, end - base};
+}
+
+void Memblock::remove_range(MemblockType& type, PhysicalAddress base, PhysicalAddress end) {
+    usize i = 0;
+    while (i < type.count) {
+        MemblockRegion& region = type.regions[i];
+        PhysicalAddress region_end = region.base + region.size;
+
+        if (region_end <= base || region.base >= end) {
+            i++;
+        } else if (region.base < base && region_end > end) {
+            // Punch a hole: the tail becomes a region of its own
+            region.size = base - region.base;
+            add_range(type, end, region_end);
+            return;
+        } else if (region.base < base) {
+            region.size = base - region.base;
+            i++;
+        } else if (region_end > end) {
+            region = MemblockRegion{end, region_end - end};
+            i++;
+        } else {
+            for (usize j = i; j + 1 < type.count; j++) {
+                type.regions[j] = type.regions[j + 1];
+            }
+            type.count--;
+        }
+    }
+}
+
+} // namespace tiny_os::memory
@@ -0,0 +1,141 @@
+#include <tiny_os/memory/pcid.h>
+#include <tiny_os/arch/x86_64/cpu.h>
+#include <tiny_os/drivers/vga.h>
+#include <tiny_os/drivers/serial.h>
+
+namespace tiny_os::memory {
+
+bool Pcid::enabled_ = false;
+bool Pcid::invpcid_ = false;
+uint16 Pcid::next_pcid_ = 1;
+uint64 Pcid::generation_ = 1;
+uint64 Pcid::rollovers_ = 0;
+
+namespace {
+
+constexpr uint64 CR4_PGE = 1ULL << 7;
+constexpr uint64 CR4_PCIDE = 1ULL << 17;
+constexpr uint64 CR3_PCID_MASK = 0xFFF;
+
+// INVPCID types
+constexpr uint64 INVPCID_ADDRESS = 0;
+constexpr uint64 INVPCID_CONTEXT = 1;
+constexpr uint64 INVPCID_ALL_GLOBAL = 2;
+
+} // namespace
+
+void Pcid::init() {
+    using arch::x86_64::CPU;
+
+    if (!CPU::has_pcid()) {
+        drivers::serial_printf("PCID: not supported, CR3 switches flush the TLB\n");
+        return;
+    }
+
+    invpcid_ = CPU::has_invpcid();
+    next_pcid_ = 1;
+    generation_ = 1;
+
+    CPU::write_cr4(CPU::read_cr4() | CR4_PCIDE);
+    enabled_ = true;
+
+    drivers::serial_printf("PCID: enabled%s\n", invpcid_ ? ", INVPCID" : "");
+}
+
+bool Pcid::enabled() {
+    return enabled_;
+}
+
+uint64 Pcid::cr3_for(PhysicalAddress pml4_phys, PcidTag& tag) {
+    if (tag.generation != generation_) {
+        if (next_pcid_ == COUNT) {
+            // Out of PCIDs: start a new generation on a clean TLB
+            invalidate_all();
+            generation_++;
+            next_pcid_ = 1;
+            rollovers_++;
+        }
+        tag.pcid = next_pcid_++;
+        tag.generation = generation_;
+    }
+
+    // A PCID is never reused within a generation, so whatever the TLB holds
+    // for it is current and the switch need not flush
+    return pml4_phys | tag.pcid | CR3_NOFLUSH;
+}
+
+void Pcid::invalidate_page(PcidTag& tag, VirtualAddress virt) {
+    if (!enabled_) {
+        asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
+        return;
+    }
+
+    if (tag.generation != generation_) {
+        return;     // Nothing cached under a retired tag
+    }
+
+    if (tag.pcid == current_pcid()) {
+        asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
+    } else if (invpcid_) {
+        invpcid(INVPCID_ADDRESS, tag.pcid, virt);
+    } else {
+        tag.generation = 0;
+    }
+}
+
+void Pcid::invalidate_context(PcidTag& tag) {
+    if (!enabled_ || tag.generation != generation_) {
+        return;
+    }
+
+    if (tag.pcid == current_pcid()) {
+        // Reloading CR3 without the no-flush bit flushes the current PCID
+        uint64 cr3 = read_cr3();
+        asm volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+    } else if (invpcid_) {
+        invpcid(INVPCID_CONTEXT, tag.pcid, 0);
+    } else {
+        tag.generation = 0;
+    }
+}
+
+void Pcid::invalidate_all() {
+    using arch::x86_64::CPU;
+
+    if (invpcid_) {
+        invpcid(INVPCID_ALL_GLOBAL, 0, 0);
+        return;
+    }
+
+    // Any change of CR4.PGE flushes all PCIDs and global entries
+    uint64 cr4 = CPU::read_cr4();
+    CPU::write_cr4(cr4 ^ CR4_PGE);
+    CPU::write_cr4(cr4);
+}
+
+void Pcid::print_stats() {
+    drivers::kprintf("PCID: %s, generation %u, next %u, %u rollover(s)\n",
+                    enabled_ ? "enabled" : "disabled",
+                    generation_, next_pcid_, rollovers_);
+}
+
+uint64 Pcid::read_cr3() {
+    uint64 cr3;
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    return cr3;
+}
+
+uint16 Pcid::current_pcid() {
+    return static_cast<uint16>(read_cr3() & CR3_PCID_MASK);
+}
+
+void Pcid::invpcid(uint64 type, uint16 pcid, VirtualAddress virt) {
+    struct {
+        uint64 pcid;
+        uint64 address;
+    } descriptor = {pcid, virt};
+
+    asm volatile("invpcid %0, %1" : : "m"(descriptor), "r"(type) : "memory");
+}
+
+} // namespace tiny_os::memory
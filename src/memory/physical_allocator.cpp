@@ -1,4 +1,8 @@
 #include <tiny_os/memory/physical_allocator.h>
+#include <tiny_os/memory/physmap.h>
+#include <tiny_os/memory/memblock.h>
+#include <tiny_os/arch/x86_64/idt.h>
+#include <tiny_os/arch/x86_64/acpi.h>
 #include <tiny_os/common/multiboot2.h>
 #include <tiny_os/common/string.h>
 #include <tiny_os/drivers/vga.h>
@@ -7,21 +11,25 @@
 
 namespace tiny_os::memory {
 
-uint32* PhysicalAllocator::bitmap_ = nullptr;
+uint64* PhysicalAllocator::bitmap_ = nullptr;
 usize PhysicalAllocator::bitmap_size_ = 0;
+uint16* PhysicalAllocator::extra_refs_ = nullptr;
+uint16* PhysicalAllocator::table_entries_ = nullptr;
+usize PhysicalAllocator::frame_count_ = 0;
 usize PhysicalAllocator::total_frames_ = 0;
 usize PhysicalAllocator::used_frames_ = 0;
 PhysicalAddress PhysicalAllocator::memory_end_ = 0;
+MemoryNode PhysicalAllocator::nodes_[MAX_NODES] = {};
+usize PhysicalAllocator::node_count_ = 1;
+usize PhysicalAllocator::cpu_nodes_[arch::x86_64::CPU::MAX_CPUS] = {};
+FrameMagazine PhysicalAllocator::magazines_[arch::x86_64::CPU::MAX_CPUS] = {};
 
-// External symbol from linker script
-extern "C" uint8 kernel_physical_end;
-
-void PhysicalAllocator::init(void* multiboot_info) {
+void PhysicalAllocator::init() {
     drivers::kprintf("Initializing physical memory allocator...\n");
     drivers::serial_printf("Physical allocator init\n");
 
-    // Parse multiboot info
-    Multiboot2::parse(multiboot_info);
+    // NUMA topology from the ACPI SRAT/SLIT
+    arch::x86_64::ACPI::init();
 
     // Print memory map
     Multiboot2::print_memory_map();
@@ -35,132 +43,306 @@ void PhysicalAllocator::init(void* multiboot_info) {
     drivers::serial_printf("Total: %lu bytes, Available: %lu bytes\n",
                           total_mem, available_mem);
 
-    // Calculate number of frames (assume max 4GB for now)
-    memory_end_ = 0x100000000ULL;  // 4GB
-    total_frames_ = memory_end_ / FRAME_SIZE;
-
-    // Calculate bitmap size in uint32s
-    bitmap_size_ = (total_frames_ + BITMAP_ENTRIES_PER_UINT32 - 1) /
-                   BITMAP_ENTRIES_PER_UINT32;
-
-    // Place bitmap after kernel end
-    PhysicalAddress kernel_end_phys =
-        reinterpret_cast<PhysicalAddress>(&kernel_physical_end);
-    bitmap_ = reinterpret_cast<uint32*>(kernel_end_phys);
-
-    drivers::serial_printf("Kernel ends at: 0x%lx\n", kernel_end_phys);
-    drivers::serial_printf("Bitmap at: 0x%lx, size: %lu bytes\n",
-                          reinterpret_cast<uint64>(bitmap_),
-                          bitmap_size_ * sizeof(uint32));
+    // Size the frame database from the highest usable address
+    memory_end_ = Memblock::memory_end();
+    frame_count_ = memory_end_ / FRAME_SIZE;
 
-    // Initialize bitmap (mark all as used)
-    memset(bitmap_, 0xFF, bitmap_size_ * sizeof(uint32));
-    used_frames_ = total_frames_;
+    // Calculate bitmap size in uint64s
+    bitmap_size_ = (frame_count_ + BITMAP_ENTRIES_PER_UINT64 - 1) /
+                   BITMAP_ENTRIES_PER_UINT64;
 
-    // Mark available memory regions as free
-    auto* mmap_tag = reinterpret_cast<const MultibootTagMmap*>(
-        Multiboot2::find_tag(MultibootTagType::MMAP));
+    // Split memory into nodes; their zone free areas follow the frame bitmap
+    setup_nodes();
 
-    if (!mmap_tag) {
-        kernel::panic("No memory map found!");
+    // The frame database (frame bitmap, free areas, reference and
+    // page-table entry counts) comes from memblock. Each zone boundary may
+    // cost every order a word per bitmap level, hence the slack per node.
+    usize words = bitmap_size_;
+    for (usize n = 0; n < node_count_; n++) {
+        words += zone_words(nodes_[n].start_frame, nodes_[n].end_frame) +
+                 ZONE_COUNT * (MAX_ORDER + 1) * 3;
     }
+    usize database_size = words * sizeof(uint64) + 2 * frame_count_ * sizeof(uint16);
+    bitmap_ = phys_to_virt<uint64>(Memblock::alloc(database_size));
 
-    auto* entry = reinterpret_cast<const MultibootMmapEntry*>(
-        reinterpret_cast<const uint8*>(mmap_tag) + sizeof(MultibootTagMmap));
+    drivers::serial_printf("Memory end: 0x%lx (%lu frames)\n", memory_end_, frame_count_);
+    drivers::serial_printf("Frame database at: 0x%lx, size: %lu bytes\n",
+                          virt_to_phys(bitmap_), database_size);
 
-    const uint8* end = reinterpret_cast<const uint8*>(mmap_tag) + mmap_tag->size;
-
-    while (reinterpret_cast<const uint8*>(entry) < end) {
-        if (entry->type == static_cast<uint32>(MemoryType::AVAILABLE)) {
-            PhysicalAddress start = entry->addr;
-            PhysicalAddress end_addr = entry->addr + entry->len;
-
-            // Align to frame boundaries
-            start = page_align_up(start);
-            end_addr = page_align_down(end_addr);
+    uint64* storage = bitmap_ + bitmap_size_;
+    for (usize n = 0; n < node_count_; n++) {
+        storage = setup_node(nodes_[n], storage);
+    }
 
-            // Free each frame in this region
-            for (PhysicalAddress addr = start; addr < end_addr; addr += FRAME_SIZE) {
-                usize frame = addr / FRAME_SIZE;
-                if (frame < total_frames_) {
-                    clear_frame(frame);
-                    used_frames_--;
-                }
+    // Reference counts and page-table entry counts close the frame database
+    extra_refs_ = reinterpret_cast<uint16*>(storage);
+    memset(extra_refs_, 0, frame_count_ * sizeof(uint16));
+    table_entries_ = extra_refs_ + frame_count_;
+    memset(table_entries_, 0, frame_count_ * sizeof(uint16));
+
+    // Everything starts out used; memblock hands over what nobody reserved
+    // (the low 1MB, kernel image, boot information, modules and early
+    // allocations such as this database stay used)
+    memset(bitmap_, 0xFF, bitmap_size_ * sizeof(uint64));
+    total_frames_ = Memblock::memory_size() / FRAME_SIZE;
+    Memblock::hand_over([](PhysicalAddress start, PhysicalAddress end) {
+        mark_frames(start / FRAME_SIZE, (end - start) / FRAME_SIZE, false);
+    });
+
+    // Hand every free run of frames to the buddy allocator
+    usize free_count = 0;
+    usize run_start = INVALID_FRAME;
+    for (usize i = 0; i < bitmap_size_; i++) {
+        uint64 free_bits = ~bitmap_[i];
+        usize bit = 0;
+
+        while (bit < BITMAP_ENTRIES_PER_UINT64) {
+            if (run_start == INVALID_FRAME) {
+                uint64 rest = free_bits >> bit;
+                if (rest == 0) break;
+                bit += __builtin_ctzll(rest);
+                run_start = i * BITMAP_ENTRIES_PER_UINT64 + bit;
+            } else {
+                uint64 rest = ~free_bits >> bit;
+                if (rest == 0) break;
+                bit += __builtin_ctzll(rest);
+                usize run_end = i * BITMAP_ENTRIES_PER_UINT64 + bit;
+                free_range(run_start, run_end - run_start);
+                free_count += run_end - run_start;
+                run_start = INVALID_FRAME;
             }
         }
-
-        entry = reinterpret_cast<const MultibootMmapEntry*>(
-            reinterpret_cast<const uint8*>(entry) + mmap_tag->entry_size);
     }
-
-    // Mark first 1MB as used (BIOS, VGA, etc.)
-    for (usize frame = 0; frame < 0x100000 / FRAME_SIZE; frame++) {
-        if (!test_frame(frame)) {
-            set_frame(frame);
-            used_frames_++;
-        }
+    if (run_start != INVALID_FRAME) {
+        free_range(run_start, frame_count_ - run_start);
+        free_count += frame_count_ - run_start;
     }
 
-    // Mark kernel and bitmap area as used
-    PhysicalAddress bitmap_end = reinterpret_cast<PhysicalAddress>(bitmap_) +
-                                  bitmap_size_ * sizeof(uint32);
-    for (PhysicalAddress addr = 0x100000; addr < bitmap_end; addr += FRAME_SIZE) {
-        usize frame = addr / FRAME_SIZE;
-        if (!test_frame(frame)) {
-            set_frame(frame);
-            used_frames_++;
+    used_frames_ = total_frames_ - free_count;
+    for (usize n = 0; n < node_count_; n++) {
+        for (MemoryZone& zone : nodes_[n].zones) {
+            zone.managed_frames = zone.free_frames();
         }
     }
 
     print_stats();
 }
 
-PhysicalAddress PhysicalAllocator::allocate_frame() {
-    usize frame = find_free_frame();
-    if (frame == static_cast<usize>(-1)) {
-        kernel::panic("Out of physical memory!");
+PhysicalAddress PhysicalAllocator::allocate_frame(uint32 flags) {
+    // Zone-restricted requests bypass the magazines
+    if (flags != AllocFlags::NONE) {
+        return allocate_frames(1, flags);
+    }
+
+    // Magazines are per-CPU, so only local interrupts need to be held off
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    FrameMagazine& magazine = magazines_[arch::x86_64::CPU::current_index()];
+    magazine.allocs++;
+
+    if (magazine.count == 0) {
+        refill_magazine(magazine);
     }
 
-    set_frame(frame);
-    used_frames_++;
+    PhysicalAddress addr = magazine.frames[--magazine.count];
+    set_frame(addr / FRAME_SIZE);
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
 
-    return frame * FRAME_SIZE;
+    return addr;
 }
 
 void PhysicalAllocator::free_frame(PhysicalAddress addr) {
     usize frame = addr / FRAME_SIZE;
-    if (frame >= total_frames_) {
+    if (frame >= frame_count_) {
         drivers::serial_printf("WARNING: Attempt to free invalid frame: 0x%lx\n", addr);
         return;
     }
 
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    // Frames parked in a magazine have their bit clear, so a second free
+    // of the same frame is caught here
     if (!test_frame(frame)) {
+        if (interrupts_enabled) {
+            arch::x86_64::IDT::enable_interrupts();
+        }
         drivers::serial_printf("WARNING: Double free of frame: 0x%lx\n", addr);
         return;
     }
-
     clear_frame(frame);
-    used_frames_--;
+
+    FrameMagazine& magazine = magazines_[arch::x86_64::CPU::current_index()];
+    magazine.frees++;
+    magazine.frames[magazine.count++] = frame * FRAME_SIZE;
+
+    if (magazine.count >= FrameMagazine::HIGH_WATERMARK) {
+        drain_magazine(magazine);
+    }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+}
+
+PhysicalAddress PhysicalAllocator::allocate_frames(usize count, uint32 flags) {
+    return allocate_frames_on(current_node(), count, flags);
 }
 
-PhysicalAddress PhysicalAllocator::allocate_frames(usize count) {
-    usize start_frame = find_free_frames(count);
-    if (start_frame == static_cast<usize>(-1)) {
+PhysicalAddress PhysicalAllocator::allocate_frames_on(usize node, usize count,
+                                                      uint32 flags) {
+    PhysicalAddress addr = try_allocate_frames_on(node, count, flags);
+    if (count != 0 && addr == 0) {
         kernel::panic("Out of contiguous physical memory!");
     }
+    return addr;
+}
 
-    for (usize i = 0; i < count; i++) {
-        set_frame(start_frame + i);
-        used_frames_++;
+PhysicalAddress PhysicalAllocator::try_allocate_frames(usize count, uint32 flags) {
+    return try_allocate_frames_on(current_node(), count, flags);
+}
+
+PhysicalAddress PhysicalAllocator::try_allocate_frames_on(usize node, usize count,
+                                                          uint32 flags) {
+    if (count == 0) return 0;
+    if (node >= node_count_) node = 0;
+
+    // The free areas are shared with the magazine paths, which run with
+    // interrupts disabled
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    usize start_frame;
+    usize order = order_for(count);
+    if (order <= MAX_ORDER) {
+        start_frame = allocate_block(order, flags, node);
+
+        // Give back the tail of the block we don't need
+        usize block_frames = static_cast<usize>(1) << order;
+        if (start_frame != INVALID_FRAME && block_frames > count) {
+            free_range(start_frame + count, block_frames - count);
+        }
+    } else {
+        usize limit = frame_count_;
+        if (flags & AllocFlags::DMA) limit = DMA_LIMIT / FRAME_SIZE;
+        else if (flags & AllocFlags::DMA32) limit = DMA32_LIMIT / FRAME_SIZE;
+        if (limit > frame_count_) limit = frame_count_;
+
+        start_frame = find_free_frames(count, limit);
+        if (start_frame != INVALID_FRAME) {
+            claim_range(start_frame, count);
+        }
+    }
+
+    if (start_frame != INVALID_FRAME) {
+        mark_frames(start_frame, count, true);
+        used_frames_ += count;
+    }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
     }
 
-    return start_frame * FRAME_SIZE;
+    return start_frame != INVALID_FRAME ? start_frame * FRAME_SIZE : 0;
 }
 
 void PhysicalAllocator::free_frames(PhysicalAddress addr, usize count) {
+    usize first = addr / FRAME_SIZE;
+    if (first >= frame_count_ || count > frame_count_ - first) {
+        drivers::serial_printf("WARNING: Attempt to free invalid range: 0x%lx (%lu frames)\n",
+                              addr, count);
+        return;
+    }
+
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    bool valid = true;
     for (usize i = 0; i < count; i++) {
-        free_frame(addr + i * FRAME_SIZE);
+        if (!test_frame(first + i)) {
+            drivers::serial_printf("WARNING: Double free of frame: 0x%lx\n",
+                                  (first + i) * FRAME_SIZE);
+            valid = false;
+            break;
+        }
+    }
+
+    if (valid) {
+        mark_frames(first, count, false);
+        used_frames_ -= count;
+        free_range(first, count);
+    }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+}
+
+void PhysicalAllocator::ref_frame(PhysicalAddress addr) {
+    usize frame = addr / FRAME_SIZE;
+    if (frame >= frame_count_ || !test_frame(frame)) {
+        drivers::serial_printf("WARNING: Reference to free frame: 0x%lx\n", addr);
+        return;
+    }
+
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    if (extra_refs_[frame] == 0xFFFF) {
+        kernel::panic("Frame reference count overflow");
+    }
+    extra_refs_[frame]++;
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+}
+
+bool PhysicalAllocator::unref_frame(PhysicalAddress addr) {
+    usize frame = addr / FRAME_SIZE;
+    if (frame >= frame_count_) {
+        drivers::serial_printf("WARNING: Unreference of invalid frame: 0x%lx\n", addr);
+        return false;
+    }
+
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    bool last = (extra_refs_[frame] == 0);
+    if (!last) {
+        extra_refs_[frame]--;
     }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+
+    if (last) {
+        free_frame(addr);
+    }
+    return last;
+}
+
+usize PhysicalAllocator::frame_refs(PhysicalAddress addr) {
+    usize frame = addr / FRAME_SIZE;
+    if (frame >= frame_count_ || !test_frame(frame)) return 0;
+    return extra_refs_[frame] + 1;
 }
 
 usize PhysicalAllocator::total_frames() {
@@ -168,11 +350,36 @@ usize PhysicalAllocator::total_frames() {
 }
 
 usize PhysicalAllocator::used_frames() {
-    return used_frames_;
+    // Frames parked in magazines are free from the caller's point of view
+    return used_frames_ - cached_frames();
 }
 
 usize PhysicalAllocator::free_frames() {
-    return total_frames_ - used_frames_;
+    return total_frames_ - used_frames();
+}
+
+usize PhysicalAllocator::cached_frames() {
+    usize cached = 0;
+    for (const FrameMagazine& magazine : magazines_) {
+        cached += magazine.count;
+    }
+    return cached;
+}
+
+PhysicalAddress PhysicalAllocator::memory_end() {
+    return memory_end_;
+}
+
+usize PhysicalAllocator::node_count() {
+    return node_count_;
+}
+
+usize PhysicalAllocator::current_node() {
+    return cpu_nodes_[arch::x86_64::CPU::current_index()];
+}
+
+usize PhysicalAllocator::node_of(PhysicalAddress addr) {
+    return static_cast<usize>(&node_for(addr / FRAME_SIZE) - nodes_);
 }
 
 void PhysicalAllocator::print_stats() {
@@ -181,8 +388,8 @@ void PhysicalAllocator::print_stats() {
                     total_frames_,
                     (total_frames_ * FRAME_SIZE) / (1024 * 1024));
     drivers::kprintf("Used frames:  %u (%u MB)\n",
-                    used_frames_,
-                    (used_frames_ * FRAME_SIZE) / (1024 * 1024));
+                    used_frames(),
+                    (used_frames() * FRAME_SIZE) / (1024 * 1024));
     drivers::kprintf("Free frames:  %u (%u MB)\n",
                     free_frames(),
                     (free_frames() * FRAME_SIZE) / (1024 * 1024));
@@ -190,46 +397,430 @@ void PhysicalAllocator::print_stats() {
     drivers::serial_printf("Physical memory: %lu MB free / %lu MB total\n",
                           (free_frames() * FRAME_SIZE) / (1024 * 1024),
                           (total_frames_ * FRAME_SIZE) / (1024 * 1024));
+
+    uint64 ops = 0;
+    uint64 misses = 0;
+    for (const FrameMagazine& magazine : magazines_) {
+        ops += magazine.allocs + magazine.frees;
+        misses += magazine.refills + magazine.drains;
+    }
+    drivers::serial_printf("Frame magazines: %lu cached, %lu ops, hit rate %lu%%\n",
+                          cached_frames(), ops,
+                          ops ? ((ops - misses) * 100) / ops : 100);
+
+    for (usize n = 0; n < node_count_; n++) {
+        const MemoryNode& node = nodes_[n];
+        usize managed = node.managed_frames();
+        usize free = node.free_frames();
+
+        // Frames cached in magazines count as used here
+        drivers::kprintf("Node %u: %u MB free, %u MB used / %u MB\n", n,
+                        (free * FRAME_SIZE) / (1024 * 1024),
+                        ((managed - free) * FRAME_SIZE) / (1024 * 1024),
+                        (managed * FRAME_SIZE) / (1024 * 1024));
+        drivers::serial_printf("Node %lu [0x%lx-0x%lx): %lu free, %lu used frames\n", n,
+                              node.start_frame * FRAME_SIZE,
+                              node.end_frame * FRAME_SIZE,
+                              free, managed - free);
+
+        for (const MemoryZone& zone : node.zones) {
+            if (zone.managed_frames == 0) continue;
+
+            drivers::kprintf("  Zone %-6s: %u MB free / %u MB\n", zone.name,
+                            (zone.free_frames() * FRAME_SIZE) / (1024 * 1024),
+                            (zone.managed_frames * FRAME_SIZE) / (1024 * 1024));
+
+            drivers::serial_printf("  Zone %s [0x%lx-0x%lx) free blocks per order:",
+                                  zone.name,
+                                  zone.start_frame * FRAME_SIZE,
+                                  zone.end_frame * FRAME_SIZE);
+            for (usize order = 0; order <= MAX_ORDER; order++) {
+                drivers::serial_printf(" %lu", zone.free_area[order].free_blocks);
+            }
+            drivers::serial_printf("\n");
+        }
+    }
 }
 
 void PhysicalAllocator::set_frame(usize frame_index) {
-    usize idx = frame_index / BITMAP_ENTRIES_PER_UINT32;
-    usize bit = frame_index % BITMAP_ENTRIES_PER_UINT32;
-    bitmap_[idx] |= (1U << bit);
+    usize idx = frame_index / BITMAP_ENTRIES_PER_UINT64;
+    usize bit = frame_index % BITMAP_ENTRIES_PER_UINT64;
+    bitmap_[idx] |= (1ULL << bit);
 }
 
 void PhysicalAllocator::clear_frame(usize frame_index) {
-    usize idx = frame_index / BITMAP_ENTRIES_PER_UINT32;
-    usize bit = frame_index % BITMAP_ENTRIES_PER_UINT32;
-    bitmap_[idx] &= ~(1U << bit);
+    usize idx = frame_index / BITMAP_ENTRIES_PER_UINT64;
+    usize bit = frame_index % BITMAP_ENTRIES_PER_UINT64;
+    bitmap_[idx] &= ~(1ULL << bit);
 }
 
 bool PhysicalAllocator::test_frame(usize frame_index) {
-    usize idx = frame_index / BITMAP_ENTRIES_PER_UINT32;
-    usize bit = frame_index % BITMAP_ENTRIES_PER_UINT32;
-    return (bitmap_[idx] & (1U << bit)) != 0;
+    usize idx = frame_index / BITMAP_ENTRIES_PER_UINT64;
+    usize bit = frame_index % BITMAP_ENTRIES_PER_UINT64;
+    return (bitmap_[idx] & (1ULL << bit)) != 0;
 }
 
-usize PhysicalAllocator::find_free_frame() {
-    for (usize i = 0; i < bitmap_size_; i++) {
-        if (bitmap_[i] != 0xFFFFFFFF) {
-            // Found a uint32 with at least one free bit
-            for (usize bit = 0; bit < BITMAP_ENTRIES_PER_UINT32; bit++) {
-                if ((bitmap_[i] & (1U << bit)) == 0) {
-                    return i * BITMAP_ENTRIES_PER_UINT32 + bit;
-                }
+void PhysicalAllocator::mark_frames(usize first_frame, usize count, bool used) {
+    usize frame = first_frame;
+    usize end = first_frame + count;
+
+    // Leading bits up to a word boundary
+    while (frame < end && frame % BITMAP_ENTRIES_PER_UINT64 != 0) {
+        used ? set_frame(frame) : clear_frame(frame);
+        frame++;
+    }
+
+    // Whole words
+    while (end - frame >= BITMAP_ENTRIES_PER_UINT64) {
+        bitmap_[frame / BITMAP_ENTRIES_PER_UINT64] = used ? ~0ULL : 0;
+        frame += BITMAP_ENTRIES_PER_UINT64;
+    }
+
+    // Trailing bits
+    while (frame < end) {
+        used ? set_frame(frame) : clear_frame(frame);
+        frame++;
+    }
+}
+
+usize PhysicalAllocator::order_for(usize count) {
+    usize order = 0;
+    while ((static_cast<usize>(1) << order) < count) {
+        order++;
+    }
+    return order;
+}
+
+void PhysicalAllocator::setup_nodes() {
+    using arch::x86_64::ACPI;
+
+    // Lowest and highest frame owned by each node according to the SRAT
+    usize lo[MAX_NODES];
+    usize hi[MAX_NODES];
+    for (usize n = 0; n < MAX_NODES; n++) {
+        lo[n] = INVALID_FRAME;
+        hi[n] = 0;
+    }
+
+    for (usize i = 0; i < ACPI::memory_range_count(); i++) {
+        const auto& range = ACPI::memory_range(i);
+        usize first = range.base / FRAME_SIZE;
+        usize last = (range.base + range.length) / FRAME_SIZE;
+        if (first < lo[range.node]) lo[range.node] = first;
+        if (last > hi[range.node]) hi[range.node] = last;
+    }
+
+    // Order nodes with memory by their lowest frame
+    usize order[MAX_NODES];
+    usize count = 0;
+    for (usize n = 0; n < ACPI::numa_node_count(); n++) {
+        if (lo[n] == INVALID_FRAME) continue;
+
+        usize i = count++;
+        while (i > 0 && lo[order[i - 1]] > lo[n]) {
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = n;
+    }
+
+    // Interleaved ranges cannot be expressed as one span per node
+    bool usable = count > 0;
+    for (usize i = 1; i < count; i++) {
+        if (hi[order[i - 1]] > lo[order[i]]) {
+            drivers::serial_printf("WARNING: SRAT memory ranges interleave, ignoring NUMA\n");
+            usable = false;
+            break;
+        }
+    }
+
+    if (!usable) {
+        node_count_ = 1;
+        nodes_[0].start_frame = 0;
+        nodes_[0].end_frame = frame_count_;
+    } else {
+        node_count_ = ACPI::numa_node_count();
+
+        // Memory-less nodes get an empty span
+        for (usize n = 0; n < node_count_; n++) {
+            nodes_[n].start_frame = 0;
+            nodes_[n].end_frame = 0;
+        }
+
+        // Stretch the spans so holes between SRAT ranges have an owner
+        for (usize i = 0; i < count; i++) {
+            MemoryNode& node = nodes_[order[i]];
+            node.start_frame = (i == 0) ? 0 : lo[order[i]];
+            node.end_frame = (i + 1 < count) ? lo[order[i + 1]] : frame_count_;
+            if (node.start_frame > frame_count_) node.start_frame = frame_count_;
+            if (node.end_frame > frame_count_) node.end_frame = frame_count_;
+        }
+    }
+
+    // Fallback lists: every node sorted by distance, self first
+    for (usize n = 0; n < node_count_; n++) {
+        MemoryNode& node = nodes_[n];
+        node.fallback[0] = n;
+        usize filled = 1;
+
+        for (usize m = 0; m < node_count_; m++) {
+            if (m == n) continue;
+
+            usize i = filled++;
+            while (i > 1 && ACPI::node_distance(n, node.fallback[i - 1]) >
+                            ACPI::node_distance(n, m)) {
+                node.fallback[i] = node.fallback[i - 1];
+                i--;
             }
+            node.fallback[i] = m;
+        }
+    }
+
+    // Only the BSP is running; APs record their node when they come up
+    usize bsp_node = ACPI::node_for_apic(arch::x86_64::CPU::apic_id());
+    cpu_nodes_[arch::x86_64::CPU::current_index()] = bsp_node < node_count_ ? bsp_node : 0;
+}
+
+uint64* PhysicalAllocator::setup_node(MemoryNode& node, uint64* storage) {
+    // Clip the zone boundaries to the node's span
+    auto clip = [&node](usize frame) {
+        if (frame < node.start_frame) return node.start_frame;
+        if (frame > node.end_frame) return node.end_frame;
+        return frame;
+    };
+
+    usize dma_end = clip(DMA_LIMIT / FRAME_SIZE);
+    usize dma32_end = clip(DMA32_LIMIT / FRAME_SIZE);
+
+    storage = setup_zone(node.zones[ZONE_DMA], "DMA", node.start_frame, dma_end, storage);
+    storage = setup_zone(node.zones[ZONE_DMA32], "DMA32", dma_end, dma32_end, storage);
+    storage = setup_zone(node.zones[ZONE_NORMAL], "Normal", dma32_end, node.end_frame, storage);
+    return storage;
+}
+
+uint64* PhysicalAllocator::setup_zone(MemoryZone& zone, const char* name,
+                                      usize start_frame, usize end_frame,
+                                      uint64* storage) {
+    zone.name = name;
+    zone.start_frame = start_frame;
+    zone.end_frame = end_frame;
+    zone.managed_frames = 0;
+
+    for (usize order = 0; order <= MAX_ORDER; order++) {
+        FreeArea& fa = zone.free_area[order];
+        usize first_block = start_frame >> order;
+        usize blocks = end_frame > start_frame ?
+                       ((end_frame - 1) >> order) - first_block + 1 : 0;
+
+        fa.base = first_block;
+        fa.word_count = (blocks + 63) / 64;
+        fa.summary_count = (fa.word_count + 63) / 64;
+        fa.group_count = (fa.summary_count + 63) / 64;
+        fa.cursor = first_block;
+        fa.free_blocks = 0;
+
+        fa.words = storage;
+        fa.summary = fa.words + fa.word_count;
+        fa.groups = fa.summary + fa.summary_count;
+        storage = fa.groups + fa.group_count;
+
+        memset(fa.words, 0,
+               (fa.word_count + fa.summary_count + fa.group_count) * sizeof(uint64));
+    }
+
+    return storage;
+}
+
+usize PhysicalAllocator::zone_words(usize start_frame, usize end_frame) {
+    usize words = 0;
+    for (usize order = 0; order <= MAX_ORDER; order++) {
+        usize blocks = end_frame > start_frame ?
+                       ((end_frame - 1) >> order) - (start_frame >> order) + 1 : 0;
+        usize word_count = (blocks + 63) / 64;
+        usize summary_count = (word_count + 63) / 64;
+        words += word_count + summary_count + (summary_count + 63) / 64;
+    }
+    return words;
+}
+
+MemoryNode& PhysicalAllocator::node_for(usize frame_index) {
+    for (usize n = 0; n + 1 < node_count_; n++) {
+        if (frame_index >= nodes_[n].start_frame && frame_index < nodes_[n].end_frame) {
+            return nodes_[n];
         }
     }
-    return static_cast<usize>(-1);
+    return nodes_[node_count_ - 1];
+}
+
+MemoryZone& PhysicalAllocator::zone_for(usize frame_index) {
+    MemoryNode& node = node_for(frame_index);
+    if (frame_index < node.zones[ZONE_DMA].end_frame) return node.zones[ZONE_DMA];
+    if (frame_index < node.zones[ZONE_DMA32].end_frame) return node.zones[ZONE_DMA32];
+    return node.zones[ZONE_NORMAL];
 }
 
-usize PhysicalAllocator::find_free_frames(usize count) {
+usize PhysicalAllocator::highest_zone(uint32 flags) {
+    if (flags & AllocFlags::DMA) return ZONE_DMA;
+    if (flags & AllocFlags::DMA32) return ZONE_DMA32;
+    return ZONE_NORMAL;
+}
+
+usize PhysicalAllocator::allocate_block(usize order, uint32 flags, usize node) {
+    // Nearest node first; within a node prefer the highest allowed zone
+    for (usize i = 0; i < node_count_; i++) {
+        MemoryNode& candidate = nodes_[nodes_[node].fallback[i]];
+        for (usize z = highest_zone(flags) + 1; z > 0; z--) {
+            usize frame = allocate_block(candidate.zones[z - 1], order);
+            if (frame != INVALID_FRAME) return frame;
+        }
+    }
+
+    return INVALID_FRAME;
+}
+
+usize PhysicalAllocator::allocate_block(MemoryZone& zone, usize order) {
+    // Find the smallest free block that is large enough
+    for (usize current = order; current <= MAX_ORDER; current++) {
+        usize block = zone.free_area[current].find();
+        if (block == FreeArea::INVALID) continue;
+
+        zone.free_area[current].clear(block);
+
+        // Split down to the requested order, freeing the upper halves
+        while (current > order) {
+            current--;
+            block <<= 1;
+            zone.free_area[current].set(block + 1);
+        }
+
+        return block << order;
+    }
+
+    return INVALID_FRAME;
+}
+
+void PhysicalAllocator::free_block(MemoryZone& zone, usize frame_index, usize order) {
+    usize block = frame_index >> order;
+
+    // Coalesce with the buddy as long as it is free too. A buddy outside
+    // the zone is never marked free in its free areas.
+    while (order < MAX_ORDER) {
+        usize buddy = block ^ 1;
+        if (!zone.free_area[order].test(buddy)) break;
+
+        zone.free_area[order].clear(buddy);
+        block >>= 1;
+        order++;
+    }
+
+    zone.free_area[order].set(block);
+}
+
+void PhysicalAllocator::free_range(usize first_frame, usize count) {
+    // Split the range into the largest naturally aligned blocks that stay
+    // within one zone
+    usize frame = first_frame;
+    usize end = first_frame + count;
+
+    while (frame < end) {
+        MemoryZone& zone = zone_for(frame);
+        usize zone_end = end < zone.end_frame ? end : zone.end_frame;
+
+        usize order = 0;
+        while (order < MAX_ORDER &&
+               (frame & ((static_cast<usize>(2) << order) - 1)) == 0 &&
+               frame + (static_cast<usize>(2) << order) <= zone_end) {
+            order++;
+        }
+
+        free_block(zone, frame, order);
+        frame += static_cast<usize>(1) << order;
+    }
+}
+
+void PhysicalAllocator::claim_range(usize first_frame, usize count) {
+    // Remove every free block overlapping the range, giving back the parts
+    // of those blocks that lie outside it
+    usize frame = first_frame;
+    usize end = first_frame + count;
+
+    while (frame < end) {
+        MemoryZone& zone = zone_for(frame);
+        for (usize order = 0; order <= MAX_ORDER; order++) {
+            usize block = frame >> order;
+            if (!zone.free_area[order].test(block)) continue;
+
+            usize head = block << order;
+            usize tail = head + (static_cast<usize>(1) << order);
+            zone.free_area[order].clear(block);
+
+            if (head < first_frame) {
+                free_range(head, first_frame - head);
+            }
+            if (tail > end) {
+                free_range(end, tail - end);
+            }
+
+            frame = tail;
+            break;
+        }
+    }
+}
+
+void PhysicalAllocator::refill_magazine(FrameMagazine& magazine) {
+    magazine.refills++;
+
+    // Take one block covering the whole batch if there is one
+    constexpr usize batch = FrameMagazine::LOW_WATERMARK;
+    usize first = allocate_block(order_for(batch), AllocFlags::NONE, current_node());
+    if (first != INVALID_FRAME) {
+        used_frames_ += batch;
+        for (usize i = batch; i > 0; i--) {
+            magazine.frames[magazine.count++] = (first + i - 1) * FRAME_SIZE;
+        }
+        return;
+    }
+
+    // Fragmented: collect single frames instead
+    while (magazine.count < batch) {
+        usize frame = allocate_block(0, AllocFlags::NONE, current_node());
+        if (frame == INVALID_FRAME) break;
+
+        used_frames_++;
+        magazine.frames[magazine.count++] = frame * FRAME_SIZE;
+    }
+
+    if (magazine.count == 0) {
+        kernel::panic("Out of physical memory!");
+    }
+}
+
+void PhysicalAllocator::drain_magazine(FrameMagazine& magazine) {
+    magazine.drains++;
+
+    while (magazine.count > FrameMagazine::LOW_WATERMARK) {
+        usize frame = magazine.frames[--magazine.count] / FRAME_SIZE;
+        used_frames_--;
+        free_block(zone_for(frame), frame, 0);
+    }
+}
+
+usize PhysicalAllocator::find_free_frames(usize count, usize limit_frame) {
     usize found = 0;
     usize start_frame = 0;
 
-    for (usize frame = 0; frame < total_frames_; frame++) {
-        if (!test_frame(frame)) {
+    for (usize frame = 0; frame < limit_frame; frame++) {
+        // Skip fully used words in one step
+        if (frame % BITMAP_ENTRIES_PER_UINT64 == 0 &&
+            bitmap_[frame / BITMAP_ENTRIES_PER_UINT64] == ~0ULL) {
+            found = 0;
+            frame += BITMAP_ENTRIES_PER_UINT64 - 1;
+            continue;
+        }
+
+        // Frames cached in a magazine are clear in the bitmap but not in
+        // any free area, so they end a run as well
+        if (!test_frame(frame) && in_free_block(frame)) {
             if (found == 0) {
                 start_frame = frame;
             }
@@ -242,7 +833,120 @@ usize PhysicalAllocator::find_free_frames(usize count) {
         }
     }
 
-    return static_cast<usize>(-1);
+    return INVALID_FRAME;
+}
+
+bool PhysicalAllocator::in_free_block(usize frame_index) {
+    MemoryZone& zone = zone_for(frame_index);
+    for (usize order = 0; order <= MAX_ORDER; order++) {
+        if (zone.free_area[order].test(frame_index >> order)) return true;
+    }
+    return false;
+}
+
+usize MemoryZone::free_frames() const {
+    usize frames = 0;
+    for (usize order = 0; order <= BUDDY_MAX_ORDER; order++) {
+        frames += free_area[order].free_blocks << order;
+    }
+    return frames;
+}
+
+usize MemoryNode::managed_frames() const {
+    usize frames = 0;
+    for (const MemoryZone& zone : zones) {
+        frames += zone.managed_frames;
+    }
+    return frames;
+}
+
+usize MemoryNode::free_frames() const {
+    usize frames = 0;
+    for (const MemoryZone& zone : zones) {
+        frames += zone.free_frames();
+    }
+    return frames;
+}
+
+void FreeArea::set(usize block) {
+    block -= base;
+    usize w = block / 64;
+    if (words[w] == 0) {
+        if (summary[w / 64] == 0) {
+            groups[w / 4096] |= 1ULL << ((w / 64) % 64);
+        }
+        summary[w / 64] |= 1ULL << (w % 64);
+    }
+    words[w] |= 1ULL << (block % 64);
+    free_blocks++;
+}
+
+void FreeArea::clear(usize block) {
+    block -= base;
+    usize w = block / 64;
+    words[w] &= ~(1ULL << (block % 64));
+    if (words[w] == 0) {
+        summary[w / 64] &= ~(1ULL << (w % 64));
+        if (summary[w / 64] == 0) {
+            groups[w / 4096] &= ~(1ULL << ((w / 64) % 64));
+        }
+    }
+    free_blocks--;
+}
+
+bool FreeArea::test(usize block) const {
+    if (block < base) return false;
+    block -= base;
+    if (block / 64 >= word_count) return false;
+    return (words[block / 64] & (1ULL << (block % 64))) != 0;
+}
+
+usize FreeArea::find_next(usize from) const {
+    from = from > base ? from - base : 0;
+    usize w = from / 64;
+    if (w >= word_count) return INVALID;
+
+    // Rest of the starting word
+    uint64 bits = words[w] & (~0ULL << (from % 64));
+    if (bits) return base + w * 64 + __builtin_ctzll(bits);
+
+    // Next non-empty word within the same summary word
+    w++;
+    usize s = w / 64;
+    if (s >= summary_count) return INVALID;
+    bits = summary[s] & (~0ULL << (w % 64));
+    if (bits) {
+        w = s * 64 + __builtin_ctzll(bits);
+        return base + w * 64 + __builtin_ctzll(words[w]);
+    }
+
+    // Next non-empty summary word, located through the group level
+    s++;
+    for (usize g = s / 64; g < group_count; g++) {
+        bits = groups[g];
+        if (g == s / 64) bits &= ~0ULL << (s % 64);
+        if (!bits) continue;
+
+        s = g * 64 + __builtin_ctzll(bits);
+        w = s * 64 + __builtin_ctzll(summary[s]);
+        return base + w * 64 + __builtin_ctzll(words[w]);
+    }
+
+    return INVALID;
+}
+
+usize FreeArea::find() {
+    if (free_blocks == 0) return INVALID;
+
+    usize block = find_next(cursor);
+    if (block == INVALID && cursor != base) {
+        block = find_next(base);
+    }
+
+    if (block != INVALID) {
+        cursor = block;
+    }
+    return block;
 }
 
 } // namespace tiny_os::memory
@@ -0,0 +1,201 @@
+#include <tiny_os/memory/slab.h>
+#include <tiny_os/memory/physical_allocator.h>
+#include <tiny_os/memory/physmap.h>
+#include <tiny_os/arch/x86_64/idt.h>
+#include <tiny_os/drivers/vga.h>
+#include <tiny_os/drivers/serial.h>
+
+namespace tiny_os::memory {
+
+KmemCache* KmemCache::caches_ = nullptr;
+
+void* KmemCache::alloc() {
+    // Magazines are per-CPU and the slab lists are only touched with
+    // local interrupts off
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    ObjectMagazine& magazine = magazines_[arch::x86_64::CPU::current_index()];
+    if (magazine.count == 0) {
+        refill(magazine);
+    }
+
+    void* object = nullptr;
+    if (magazine.count > 0) {
+        object = magazine.objects[--magazine.count];
+        allocs_++;
+    }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+
+    return object;
+}
+
+void KmemCache::free(void* object) {
+    if (!object) return;
+
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    ObjectMagazine& magazine = magazines_[arch::x86_64::CPU::current_index()];
+    if (magazine.count == ObjectMagazine::CAPACITY) {
+        drain(magazine);
+    }
+    magazine.objects[magazine.count++] = object;
+    frees_++;
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+}
+
+void KmemCache::print_stats() {
+    drivers::kprintf("\n=== Slab Cache Statistics ===\n");
+
+    for (KmemCache* cache = caches_; cache; cache = cache->next_cache_) {
+        drivers::kprintf("%s: %u x %u bytes in use, %u slab(s) of %u KB\n",
+                        cache->name_, cache->objects_in_use_, cache->object_size_,
+                        cache->slab_count_, cache->slab_pages_ * PAGE_SIZE / 1024);
+        drivers::kprintf("  allocs: %u, frees: %u, magazine misses: %u\n",
+                        cache->allocs_, cache->frees_, cache->magazine_misses_);
+    }
+    drivers::kprintf("\n");
+}
+
+Slab* KmemCache::grow() {
+    if (empty_) {
+        Slab* slab = empty_;
+        empty_ = nullptr;
+        link_partial(slab);
+        return slab;
+    }
+
+    if (!registered_) {
+        next_cache_ = caches_;
+        caches_ = this;
+        registered_ = true;
+    }
+
+    PhysicalAddress phys = (slab_pages_ == 1) ? PhysicalAllocator::allocate_frame()
+                                              : PhysicalAllocator::allocate_frames(slab_pages_);
+    Slab* slab = phys_to_virt<Slab>(phys);
+    slab->cache = this;
+    slab->in_use = 0;
+    slab->free_list = nullptr;
+
+    // Thread the objects in address order
+    uint8* objects = reinterpret_cast<uint8*>(slab) + first_offset_;
+    for (usize i = objects_per_slab_; i > 0; i--) {
+        void* object = objects + (i - 1) * object_size_;
+        if (ctor_) {
+            ctor_(object);
+        }
+        link(object) = slab->free_list;
+        slab->free_list = object;
+    }
+
+    slab_count_++;
+    link_partial(slab);
+    return slab;
+}
+
+void KmemCache::release_slab(Slab* slab) {
+    PhysicalAddress phys = memory::virt_to_phys(slab);
+    if (slab_pages_ == 1) {
+        PhysicalAllocator::free_frame(phys);
+    } else {
+        PhysicalAllocator::free_frames(phys, slab_pages_);
+    }
+    slab_count_--;
+}
+
+void KmemCache::link_partial(Slab* slab) {
+    slab->prev = nullptr;
+    slab->next = partial_;
+    if (partial_) {
+        partial_->prev = slab;
+    }
+    partial_ = slab;
+}
+
+void KmemCache::unlink_partial(Slab* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        partial_ = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+void KmemCache::refill(ObjectMagazine& magazine) {
+    magazine_misses_++;
+
+    while (magazine.count < ObjectMagazine::BATCH) {
+        Slab* slab = partial_ ? partial_ : grow();
+        if (!slab) break;
+
+        void* object = slab->free_list;
+        slab->free_list = link(object);
+        slab->in_use++;
+        objects_in_use_++;
+
+        // Full slabs sit on no list until an object comes back
+        if (!slab->free_list) {
+            unlink_partial(slab);
+        }
+
+        magazine.objects[magazine.count++] = object;
+    }
+}
+
+void KmemCache::drain(ObjectMagazine& magazine) {
+    magazine_misses_++;
+
+    // The oldest objects go back; the most recently freed stay cache-hot
+    for (usize i = 0; i < ObjectMagazine::BATCH; i++) {
+        free_to_slab(magazine.objects[i]);
+    }
+    for (usize i = ObjectMagazine::BATCH; i < magazine.count; i++) {
+        magazine.objects[i - ObjectMagazine::BATCH] = magazine.objects[i];
+    }
+    magazine.count -= ObjectMagazine::BATCH;
+}
+
+void KmemCache::free_to_slab(void* object) {
+    Slab* slab = slab_of(object);
+    if (slab->cache != this) {
+        drivers::serial_printf("WARNING: Object 0x%lx freed to the wrong cache %s\n",
+                              reinterpret_cast<VirtualAddress>(object), name_);
+        return;
+    }
+
+    bool was_full = (slab->free_list == nullptr);
+    link(object) = slab->free_list;
+    slab->free_list = object;
+    slab->in_use--;
+    objects_in_use_--;
+
+    if (was_full) {
+        link_partial(slab);
+    }
+
+    // Keep one empty slab around so a cache at the edge does not thrash
+    if (slab->in_use == 0) {
+        unlink_partial(slab);
+        if (!empty_) {
+            empty_ = slab;
+        } else {
+            release_slab(slab);
+        }
+    }
+}
+
+} // namespace tiny_os::memory
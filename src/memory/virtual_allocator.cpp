@@ -1,5 +1,7 @@
 #include <tiny_os/memory/virtual_allocator.h>
 #include <tiny_os/memory/physical_allocator.h>
+#include <tiny_os/memory/physmap.h>
+#include <tiny_os/arch/x86_64/cpu.h>
 #include <tiny_os/common/string.h>
 #include <tiny_os/drivers/vga.h>
 #include <tiny_os/drivers/serial.h>
@@ -7,62 +9,128 @@
 namespace tiny_os::memory {
 
 PageTable* VirtualAllocator::kernel_pml4_ = nullptr;
+bool VirtualAllocator::gb_pages_ = false;
+bool VirtualAllocator::nx_ = false;
+usize VirtualAllocator::table_frames_ = 0;
+PhysicalAddress VirtualAllocator::pending_tables_ = 0;
+bool VirtualAllocator::physmap_ready_ = false;
 
 // External symbols from linker script
 extern "C" {
     extern uint8 kernel_virtual_base;
     extern uint8 kernel_physical_end;
+    extern uint8 kernel_text_start;
+    extern uint8 kernel_text_end;
+    extern uint8 kernel_rodata_start;
+    extern uint8 kernel_rodata_end;
+    extern uint8 kernel_data_start;
+    extern uint8 kernel_end;
 }
 
 void VirtualAllocator::init() {
     drivers::kprintf("\nInitializing virtual memory...\n");
     drivers::serial_printf("Virtual memory init\n");
 
+    gb_pages_ = arch::x86_64::CPU::has_1gb_pages();
+    drivers::serial_printf("Huge pages: 2MB%s\n", gb_pages_ ? ", 1GB" : "");
+
     // Allocate kernel PML4
-    PhysicalAddress pml4_phys = PhysicalAllocator::allocate_frame();
-    kernel_pml4_ = reinterpret_cast<PageTable*>(pml4_phys);
-    kernel_pml4_->clear();
+    PhysicalAddress pml4_phys = allocate_table();
+    kernel_pml4_ = phys_to_virt<PageTable>(pml4_phys);
 
     drivers::serial_printf("Kernel PML4 at: 0x%lx\n", pml4_phys);
 
-    // Identity map first 4MB (for early boot code)
-    for (PhysicalAddress addr = 0; addr < 0x400000; addr += PAGE_SIZE) {
-        map_page(addr, addr, PageFlags::PRESENT | PageFlags::WRITABLE);
+    // Nothing but the kernel's own code is executable: the identity map
+    // and the physmap below are mapped no-execute
+    nx_ = arch::x86_64::CPU::has_nx();
+    uint64 no_execute = nx_flag();
+
+    // Identity map the first 4MB (VGA text buffer) and the kernel image
+    // (boot stack), which now spans 2MB-aligned sections
+    PhysicalAddress identity_end =
+        (reinterpret_cast<PhysicalAddress>(&kernel_physical_end) + PAGE_SIZE_2M - 1) &
+        ~(PAGE_SIZE_2M - 1);
+    if (identity_end < 0x400000) {
+        identity_end = 0x400000;
     }
+    map_range(0, 0, identity_end, PageFlags::PRESENT | PageFlags::WRITABLE | no_execute);
 
-    // Map kernel to higher half (0xFFFFFFFF80000000)
-    VirtualAddress kernel_virt_base =
-        reinterpret_cast<VirtualAddress>(&kernel_virtual_base);
-    PhysicalAddress kernel_phys_end =
-        reinterpret_cast<PhysicalAddress>(&kernel_physical_end);
-
-    drivers::serial_printf("Mapping kernel: 0x%lx (virt) -> 0x0 - 0x%lx (phys)\n",
-                          kernel_virt_base, kernel_phys_end);
-
-    // Map kernel (physical 0 -> virtual KERNEL_VIRTUAL_BASE)
-    for (PhysicalAddress phys = 0; phys < kernel_phys_end; phys += PAGE_SIZE) {
-        VirtualAddress virt = kernel_virt_base + phys;
-        map_page(virt, phys, PageFlags::PRESENT | PageFlags::WRITABLE);
+    // Direct map of all physical memory, on the largest pages available
+    PhysicalAddress memory_end = PhysicalAllocator::memory_end();
+    if (memory_end > PHYSMAP_MAX_SIZE) {
+        memory_end = PHYSMAP_MAX_SIZE;
     }
-
-    // Also map some extra space for heap (16MB)
-    constexpr usize EXTRA_MAPPING = 16 * 1024 * 1024;
-    for (PhysicalAddress phys = kernel_phys_end;
-         phys < kernel_phys_end + EXTRA_MAPPING;
-         phys += PAGE_SIZE) {
-        VirtualAddress virt = kernel_virt_base + phys;
-        map_page(virt, phys, PageFlags::PRESENT | PageFlags::WRITABLE);
+    drivers::serial_printf("Physmap: 0x%lx - 0x%lx\n", PHYSMAP_BASE, PHYSMAP_BASE + memory_end);
+    map_range(PHYSMAP_BASE, 0, memory_end,
+              PageFlags::PRESENT | PageFlags::WRITABLE | no_execute);
+
+    // Map the kernel image to the higher half (0xFFFFFFFF80000000) section
+    // by section: code read-only and executable, read-only data and
+    // data/bss no-execute. linker.ld puts every section on a 2MB boundary,
+    // so only the tail of each section needs 4KB pages.
+    drivers::serial_printf("Mapping kernel: 0x%lx (virt) -> 0x0 - 0x%lx (phys)\n",
+                          reinterpret_cast<VirtualAddress>(&kernel_virtual_base),
+                          reinterpret_cast<PhysicalAddress>(&kernel_physical_end));
+
+    map_kernel_section(&kernel_text_start, &kernel_text_end, &kernel_rodata_start,
+                       PageFlags::PRESENT);
+    map_kernel_section(&kernel_rodata_start, &kernel_rodata_end, &kernel_data_start,
+                       PageFlags::PRESENT | no_execute);
+    map_kernel_section(&kernel_data_start, &kernel_end, &kernel_end,
+                       PageFlags::PRESENT | PageFlags::WRITABLE | no_execute);
+
+    // Give every kernel PML4 entry a PDPT now: process address spaces copy
+    // these entries, so later kernel mappings show up in all of them
+    for (usize i = 256; i < 512; i++) {
+        get_or_create_table((*kernel_pml4_)[i], PageFlags::PRESENT | PageFlags::WRITABLE);
     }
 
-    // Load new page table
+    // Load new page table; from here on every frame is reachable
     switch_page_table(pml4_phys);
+    physmap_ready_ = true;
+
+    // CR3 now holds PCID 0, as CR4.PCIDE requires
+    Pcid::init();
 
     drivers::kprintf("Virtual memory initialized\n");
     drivers::serial_printf("Virtual memory ready, CR3 = 0x%lx\n", pml4_phys);
 }
 
+void VirtualAllocator::map_kernel_section(const uint8* start, const uint8* end,
+                                          const uint8* next, uint64 flags) {
+    VirtualAddress virt = reinterpret_cast<VirtualAddress>(start);
+    VirtualAddress virt_end = page_align_up(reinterpret_cast<VirtualAddress>(end));
+    PhysicalAddress phys = memory::virt_to_phys(start);
+
+    map_range(virt, phys, virt_end - virt, flags);
+
+    // Read-only sections must not stay writable through an alias: drop
+    // them from the identity map (only the boot stack and VGA need it)
+    // and make the physmap copy read-only
+    if (!(flags & PageFlags::WRITABLE)) {
+        unmap_range(phys, virt_end - virt);
+        map_range(PHYSMAP_BASE + phys, phys, virt_end - virt,
+                  PageFlags::PRESENT | nx_flag());
+    }
+
+    char perms[4] = {'r', (flags & PageFlags::WRITABLE) ? 'w' : '-',
+                     (flags & PageFlags::NO_EXECUTE) ? '-' : 'x', '\0'};
+    drivers::serial_printf("  0x%lx - 0x%lx %s\n", virt, virt_end, perms);
+
+    // The alignment padding up to the next section is never mapped
+    VirtualAddress next_virt = reinterpret_cast<VirtualAddress>(next);
+    if (next_virt > virt_end) {
+        PhysicalAllocator::free_frames(phys + (virt_end - virt),
+                                       (next_virt - virt_end) / PAGE_SIZE);
+    }
+}
+
 void VirtualAllocator::map_page(VirtualAddress virt, PhysicalAddress phys,
                                 uint64 flags) {
+    if (is_kernel_address(virt)) {
+        flags |= PageFlags::GLOBAL;
+    }
+
     auto indices = PageTableIndices::from_address(virt);
 
     // Get or create PDPT
@@ -70,42 +138,251 @@ void VirtualAllocator::map_page(VirtualAddress virt, PhysicalAddress phys,
         (*kernel_pml4_)[indices.pml4],
         PageFlags::PRESENT | PageFlags::WRITABLE | (flags & PageFlags::USER));
 
-    // Get or create PD
+    // Get or create PD, breaking up a 1GB page in the way
+    PageTableEntry& pdpte = (*pdpt)[indices.pdpt];
+    if (pdpte.is_present() && pdpte.is_huge()) {
+        split_huge_page(pdpte, PAGE_SIZE_1G);
+    }
     PageTable* pd = get_or_create_table(
-        (*pdpt)[indices.pdpt],
+        pdpte,
         PageFlags::PRESENT | PageFlags::WRITABLE | (flags & PageFlags::USER));
 
-    // Get or create PT
+    // Get or create PT, breaking up a 2MB page in the way
+    PageTableEntry& pde = (*pd)[indices.pd];
+    if (pde.is_present() && pde.is_huge()) {
+        split_huge_page(pde, PAGE_SIZE_2M);
+    }
     PageTable* pt = get_or_create_table(
-        (*pd)[indices.pd],
+        pde,
         PageFlags::PRESENT | PageFlags::WRITABLE | (flags & PageFlags::USER));
 
     // Set page table entry
-    (*pt)[indices.pt].set_address(phys, flags | PageFlags::PRESENT);
+    set_entry((*pt)[indices.pt], phys, flags | PageFlags::PRESENT);
+}
+
+void VirtualAllocator::map_huge_page(VirtualAddress virt, PhysicalAddress phys,
+                                     usize page_size, uint64 flags) {
+    if ((page_size != PAGE_SIZE_2M && page_size != PAGE_SIZE_1G) ||
+        (page_size == PAGE_SIZE_1G && !gb_pages_) ||
+        ((virt | phys) & (page_size - 1)) != 0) {
+        drivers::serial_printf("WARNING: Bad huge page mapping 0x%lx -> 0x%lx (%lu bytes)\n",
+                              virt, phys, page_size);
+        return;
+    }
+
+    if (is_kernel_address(virt)) {
+        flags |= PageFlags::GLOBAL;
+    }
+
+    auto indices = PageTableIndices::from_address(virt);
+    uint64 table_flags = PageFlags::PRESENT | PageFlags::WRITABLE | (flags & PageFlags::USER);
+    TlbBatch batch;
+
+    PageTable* pdpt = get_or_create_table((*kernel_pml4_)[indices.pml4], table_flags);
+    PageTableEntry& pdpte = (*pdpt)[indices.pdpt];
+
+    if (page_size == PAGE_SIZE_1G) {
+        set_huge_entry(pdpte, phys, flags | PageFlags::PRESENT, 2, virt, batch);
+    } else {
+        if (pdpte.is_present() && pdpte.is_huge()) {
+            split_huge_page(pdpte, PAGE_SIZE_1G);
+        }
+        PageTable* pd = get_or_create_table(pdpte, table_flags);
+        set_huge_entry((*pd)[indices.pd], phys, flags | PageFlags::PRESENT, 1, virt, batch);
+    }
+
+    batch.flush();
 }
 
-void VirtualAllocator::unmap_page(VirtualAddress virt) {
+void VirtualAllocator::map_range(VirtualAddress virt, PhysicalAddress phys,
+                                 usize length, uint64 flags) {
+    if (!is_page_aligned(virt) || !is_page_aligned(phys)) {
+        drivers::serial_printf("WARNING: Unaligned range mapping 0x%lx -> 0x%lx\n",
+                              virt, phys);
+        return;
+    }
+
+    if (is_kernel_address(virt)) {
+        flags |= PageFlags::GLOBAL;
+    }
+
+    uint64 table_flags = PageFlags::PRESENT | PageFlags::WRITABLE | (flags & PageFlags::USER);
+    uint64 leaf_flags = flags | PageFlags::PRESENT;
+    VirtualAddress end = virt + page_align_up(length);
+    TlbBatch batch;
+
+    // One walk per 1GB span; PD and PT entries are filled in place
+    while (virt < end) {
+        auto indices = PageTableIndices::from_address(virt);
+        PageTable* pdpt = get_or_create_table((*kernel_pml4_)[indices.pml4], table_flags);
+        PageTableEntry& pdpte = (*pdpt)[indices.pdpt];
+
+        if (gb_pages_ && end - virt >= PAGE_SIZE_1G &&
+            ((virt | phys) & (PAGE_SIZE_1G - 1)) == 0) {
+            set_huge_entry(pdpte, phys, leaf_flags, 2, virt, batch);
+            virt += PAGE_SIZE_1G;
+            phys += PAGE_SIZE_1G;
+            continue;
+        }
+
+        if (pdpte.is_present() && pdpte.is_huge()) {
+            split_huge_page(pdpte, PAGE_SIZE_1G);
+        }
+        PageTable* pd = get_or_create_table(pdpte, table_flags);
+        VirtualAddress pd_end = span_end(virt, PAGE_SIZE_1G, end);
+
+        while (virt < pd_end) {
+            PageTableEntry& pde = (*pd)[PageTableIndices::from_address(virt).pd];
+
+            if (pd_end - virt >= PAGE_SIZE_2M &&
+                ((virt | phys) & (PAGE_SIZE_2M - 1)) == 0) {
+                set_huge_entry(pde, phys, leaf_flags, 1, virt, batch);
+                virt += PAGE_SIZE_2M;
+                phys += PAGE_SIZE_2M;
+                continue;
+            }
+
+            if (pde.is_present() && pde.is_huge()) {
+                split_huge_page(pde, PAGE_SIZE_2M);
+            }
+            PageTable* pt = get_or_create_table(pde, table_flags);
+            VirtualAddress pt_end = span_end(virt, PAGE_SIZE_2M, pd_end);
+
+            for (usize i = PageTableIndices::from_address(virt).pt; virt < pt_end; i++) {
+                if ((*pt)[i].is_present()) {
+                    batch.add(virt);
+                }
+                set_entry((*pt)[i], phys, leaf_flags);
+                virt += PAGE_SIZE;
+                phys += PAGE_SIZE;
+            }
+        }
+    }
+
+    batch.flush();
+}
+
+void VirtualAllocator::unmap_range(VirtualAddress virt, usize length, bool flush) {
+    VirtualAddress end = virt + page_align_up(length);
+    TlbBatch batch;
+
+    while (virt < end) {
+        auto indices = PageTableIndices::from_address(virt);
+
+        PageTableEntry& pml4e = (*kernel_pml4_)[indices.pml4];
+        if (!pml4e.is_present()) {
+            virt = span_end(virt, PAGE_SIZE_1G * 512, end);
+            continue;
+        }
+
+        PageTableEntry& pdpte = (*phys_to_virt<PageTable>(pml4e.get_address()))[indices.pdpt];
+        if (!pdpte.is_present()) {
+            virt = span_end(virt, PAGE_SIZE_1G, end);
+            continue;
+        }
+
+        if (pdpte.is_huge()) {
+            // Whole 1GB page inside the range: drop it, otherwise split
+            if ((virt & (PAGE_SIZE_1G - 1)) == 0 && end - virt >= PAGE_SIZE_1G) {
+                clear_entry(pdpte);
+                batch.add(virt);
+                virt += PAGE_SIZE_1G;
+                continue;
+            }
+            split_huge_page(pdpte, PAGE_SIZE_1G);
+        }
+
+        PageTable* pd = phys_to_virt<PageTable>(pdpte.get_address());
+        VirtualAddress pd_end = span_end(virt, PAGE_SIZE_1G, end);
+
+        while (virt < pd_end) {
+            PageTableEntry& pde = (*pd)[PageTableIndices::from_address(virt).pd];
+            if (!pde.is_present()) {
+                virt = span_end(virt, PAGE_SIZE_2M, pd_end);
+                continue;
+            }
+
+            if (pde.is_huge()) {
+                if ((virt & (PAGE_SIZE_2M - 1)) == 0 && pd_end - virt >= PAGE_SIZE_2M) {
+                    clear_entry(pde);
+                    batch.add(virt);
+                    virt += PAGE_SIZE_2M;
+                    continue;
+                }
+                split_huge_page(pde, PAGE_SIZE_2M);
+            }
+
+            PageTable* pt = phys_to_virt<PageTable>(pde.get_address());
+            VirtualAddress pt_end = span_end(virt, PAGE_SIZE_2M, pd_end);
+
+            for (usize i = PageTableIndices::from_address(virt).pt; virt < pt_end; i++) {
+                if ((*pt)[i].is_present()) {
+                    clear_entry((*pt)[i]);
+                    batch.add(virt);
+                }
+                virt += PAGE_SIZE;
+            }
+
+            // Free the page table once its last entry is gone
+            if (PhysicalAllocator::table_entries(pde.get_address()) == 0) {
+                release_table(pde, batch);
+            }
+        }
+
+        if (PhysicalAllocator::table_entries(pdpte.get_address()) == 0) {
+            release_table(pdpte, batch);
+        }
+    }
+
+    // Without the flush, unlinked tables wait for the caller's global flush
+    if (flush) {
+        batch.flush();
+    }
+}
+
+usize VirtualAllocator::unmap_page(VirtualAddress virt) {
     auto indices = PageTableIndices::from_address(virt);
 
-    if (!(*kernel_pml4_)[indices.pml4].is_present()) return;
+    if (!(*kernel_pml4_)[indices.pml4].is_present()) return 0;
+
+    auto* pdpt = phys_to_virt<PageTable>((*kernel_pml4_)[indices.pml4].get_address());
 
-    auto* pdpt = reinterpret_cast<PageTable*>(
-        (*kernel_pml4_)[indices.pml4].get_address());
+    PageTableEntry* pdpte = &(*pdpt)[indices.pdpt];
+    PageTableEntry* pde = nullptr;
+    PageTableEntry* entry = pdpte;
+    usize size = PAGE_SIZE_1G;
 
-    if (!(*pdpt)[indices.pdpt].is_present()) return;
+    if (entry->is_present() && !entry->is_huge()) {
+        auto* pd = phys_to_virt<PageTable>(entry->get_address());
+        pde = &(*pd)[indices.pd];
+        entry = pde;
+        size = PAGE_SIZE_2M;
 
-    auto* pd = reinterpret_cast<PageTable*>(
-        (*pdpt)[indices.pdpt].get_address());
+        if (entry->is_present() && !entry->is_huge()) {
+            auto* pt = phys_to_virt<PageTable>(entry->get_address());
+            entry = &(*pt)[indices.pt];
+            size = PAGE_SIZE;
+        }
+    }
+
+    if (!entry->is_present()) return 0;
 
-    if (!(*pd)[indices.pd].is_present()) return;
+    clear_entry(*entry);
 
-    auto* pt = reinterpret_cast<PageTable*>(
-        (*pd)[indices.pd].get_address());
+    // Invalidate TLB entry (one invlpg covers a whole huge page)
+    TlbBatch batch;
+    batch.add(virt);
 
-    (*pt)[indices.pt].clear();
+    // Free the tables this page was the last entry of
+    if (size == PAGE_SIZE && PhysicalAllocator::table_entries(pde->get_address()) == 0) {
+        release_table(*pde, batch);
+    }
+    if (size != PAGE_SIZE_1G && PhysicalAllocator::table_entries(pdpte->get_address()) == 0) {
+        release_table(*pdpte, batch);
+    }
 
-    // Invalidate TLB entry
-    asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
+    batch.flush();
+    return size;
 }
 
 PhysicalAddress VirtualAllocator::virt_to_phys(VirtualAddress virt) {
@@ -113,18 +390,23 @@ PhysicalAddress VirtualAllocator::virt_to_phys(VirtualAddress virt) {
 
     if (!(*kernel_pml4_)[indices.pml4].is_present()) return 0;
 
-    auto* pdpt = reinterpret_cast<PageTable*>(
-        (*kernel_pml4_)[indices.pml4].get_address());
+    auto* pdpt = phys_to_virt<PageTable>((*kernel_pml4_)[indices.pml4].get_address());
 
-    if (!(*pdpt)[indices.pdpt].is_present()) return 0;
+    const PageTableEntry& pdpte = (*pdpt)[indices.pdpt];
+    if (!pdpte.is_present()) return 0;
+    if (pdpte.is_huge()) {
+        return pdpte.get_address() + (virt & (PAGE_SIZE_1G - 1));
+    }
 
-    auto* pd = reinterpret_cast<PageTable*>(
-        (*pdpt)[indices.pdpt].get_address());
+    auto* pd = phys_to_virt<PageTable>(pdpte.get_address());
 
-    if (!(*pd)[indices.pd].is_present()) return 0;
+    const PageTableEntry& pde = (*pd)[indices.pd];
+    if (!pde.is_present()) return 0;
+    if (pde.is_huge()) {
+        return pde.get_address() + (virt & (PAGE_SIZE_2M - 1));
+    }
 
-    auto* pt = reinterpret_cast<PageTable*>(
-        (*pd)[indices.pd].get_address());
+    auto* pt = phys_to_virt<PageTable>(pde.get_address());
 
     if (!(*pt)[indices.pt].is_present()) return 0;
 
@@ -143,19 +425,188 @@ void VirtualAllocator::switch_page_table(PhysicalAddress pml4_phys) {
     asm volatile("mov %0, %%cr3" : : "r"(pml4_phys) : "memory");
 }
 
+void VirtualAllocator::switch_address_space(PhysicalAddress pml4_phys, PcidTag& tag) {
+    if (!Pcid::enabled()) {
+        switch_page_table(pml4_phys);
+        return;
+    }
+
+    uint64 cr3 = Pcid::cr3_for(pml4_phys, tag);
+    asm volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+void VirtualAllocator::switch_to_kernel() {
+    uint64 cr3 = memory::virt_to_phys(kernel_pml4_);
+    if (Pcid::enabled()) {
+        cr3 |= Pcid::KERNEL | Pcid::CR3_NOFLUSH;
+    }
+    asm volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
 PageTable* VirtualAllocator::get_or_create_table(PageTableEntry& entry,
                                                  uint64 flags) {
     if (entry.is_present()) {
-        return reinterpret_cast<PageTable*>(entry.get_address());
+        return phys_to_virt<PageTable>(entry.get_address());
     }
 
     // Allocate new page table
-    PhysicalAddress phys = PhysicalAllocator::allocate_frame();
-    auto* table = reinterpret_cast<PageTable*>(phys);
-    table->clear();
+    PhysicalAddress phys = allocate_table();
+    set_entry(entry, phys, flags | PageFlags::PRESENT);
+    return phys_to_virt<PageTable>(phys);
+}
+
+PageTable* VirtualAllocator::split_huge_page(PageTableEntry& entry, usize page_size) {
+    PhysicalAddress base = entry.get_address();
+    uint64 flags = entry.value & ~0x000FFFFFFFFFF000ULL;
+    usize child_size = page_size / 512;
+
+    // 4KB entries use bit 7 for PAT, not for the page size
+    uint64 child_flags = (child_size == PAGE_SIZE) ? (flags & ~PageFlags::HUGE_PAGE) : flags;
 
-    entry.set_address(phys, flags | PageFlags::PRESENT);
+    PhysicalAddress table_phys = allocate_table();
+    auto* table = phys_to_virt<PageTable>(table_phys);
+    for (usize i = 0; i < 512; i++) {
+        (*table)[i].set_address(base + i * child_size, child_flags);
+    }
+    PhysicalAllocator::table_entries(table_phys) = 512;
+
+    // Translations are unchanged, so no TLB flush is needed
+    entry.set_address(table_phys,
+                      PageFlags::PRESENT | PageFlags::WRITABLE | (flags & PageFlags::USER));
     return table;
 }
 
+PhysicalAddress VirtualAllocator::allocate_table() {
+    // Until the kernel page tables are live only the boot physmap (first
+    // 4GB) is reachable
+    PhysicalAddress phys = PhysicalAllocator::allocate_frame(
+        physmap_ready_ ? AllocFlags::NONE : AllocFlags::DMA32);
+    phys_to_virt<PageTable>(phys)->clear();
+    PhysicalAllocator::table_entries(phys) = 0;
+    table_frames_++;
+    return phys;
+}
+
+void VirtualAllocator::set_entry(PageTableEntry& entry, PhysicalAddress phys, uint64 flags) {
+    if (!entry.is_present()) {
+        PhysicalAllocator::table_entries(page_align_down(memory::virt_to_phys(&entry)))++;
+    }
+    entry.set_address(phys, flags);
+}
+
+void VirtualAllocator::clear_entry(PageTableEntry& entry) {
+    if (entry.is_present()) {
+        PhysicalAllocator::table_entries(page_align_down(memory::virt_to_phys(&entry)))--;
+    }
+    entry.clear();
+}
+
+void VirtualAllocator::release_table(PageTableEntry& parent, TlbBatch& batch) {
+    PhysicalAddress table = parent.get_address();
+    clear_entry(parent);
+
+    // The empty table links the pending list through its first entry
+    *phys_to_virt<PhysicalAddress>(table) = pending_tables_;
+    pending_tables_ = table;
+    batch.tables = true;
+}
+
+void VirtualAllocator::free_table(PhysicalAddress table_phys, usize level) {
+    if (level > 1) {
+        PageTable* table = phys_to_virt<PageTable>(table_phys);
+        for (usize i = 0; i < 512; i++) {
+            if ((*table)[i].is_present() && !(*table)[i].is_huge()) {
+                free_table((*table)[i].get_address(), level - 1);
+            }
+        }
+    }
+
+    PhysicalAllocator::free_frame(table_phys);
+    table_frames_--;
+}
+
+void VirtualAllocator::set_huge_entry(PageTableEntry& entry, PhysicalAddress phys,
+                                      uint64 flags, usize table_level,
+                                      VirtualAddress virt, TlbBatch& batch) {
+    if (!entry.is_present() || entry.is_huge()) {
+        if (entry.is_present()) {
+            batch.add(virt);
+        }
+        set_entry(entry, phys, flags | PageFlags::HUGE_PAGE);
+        return;
+    }
+
+    // A table of smaller pages is replaced wholesale. Flush before freeing
+    // it so no stale translation can point into the recycled frame.
+    PhysicalAddress old_table = entry.get_address();
+    entry.set_address(phys, flags | PageFlags::HUGE_PAGE);
+    if (is_kernel_address(virt)) {
+        flush_tlb_global();
+    } else {
+        flush_tlb();
+    }
+    free_table(old_table, table_level);
+}
+
+VirtualAddress VirtualAllocator::span_end(VirtualAddress virt, usize span,
+                                          VirtualAddress end) {
+    VirtualAddress boundary = (virt & ~(span - 1)) + span;
+    return (boundary == 0 || boundary > end) ? end : boundary;
+}
+
+void TlbBatch::add(VirtualAddress virt) {
+    if (count < MAX_PAGES) {
+        pages[count] = virt;
+    }
+    if (is_kernel_address(virt)) {
+        kernel = true;
+    }
+    count++;
+}
+
+void TlbBatch::flush() {
+    if (tables || (count > MAX_PAGES && kernel)) {
+        VirtualAllocator::flush_tlb_global();
+    } else if (count > MAX_PAGES) {
+        VirtualAllocator::flush_tlb();
+    } else {
+        // invlpg drops global entries whatever the current PCID
+        for (usize i = 0; i < count; i++) {
+            asm volatile("invlpg (%0)" : : "r"(pages[i]) : "memory");
+        }
+    }
+    count = 0;
+    kernel = false;
+    tables = false;
+}
+
+void VirtualAllocator::flush_tlb() {
+    // A CR3 reload only flushes the current PCID
+    if (Pcid::enabled()) {
+        Pcid::invalidate_all();
+        return;
+    }
+
+    uint64 cr3;
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    asm volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+void VirtualAllocator::flush_tlb_global() {
+    // INVPCID or a CR4.PGE toggle; both work with PCIDs disabled too
+    Pcid::invalidate_all();
+
+    // No paging-structure cache can reach the unlinked tables any more
+    while (pending_tables_ != 0) {
+        PhysicalAddress table = pending_tables_;
+        pending_tables_ = *phys_to_virt<PhysicalAddress>(table);
+        PhysicalAllocator::free_frame(table);
+        table_frames_--;
+    }
+}
+
+usize VirtualAllocator::table_frames() {
+    return table_frames_;
+}
+
 } // namespace tiny_os::memory
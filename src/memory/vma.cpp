@@ -0,0 +1,160 @@
+#include <tiny_os/memory/vma.h>
+
+namespace tiny_os::memory {
+
+Vma* VmaTree::find(VirtualAddress addr) const {
+    Vma* vma = lower_bound(addr);
+    return (vma && vma->start <= addr) ? vma : nullptr;
+}
+
+Vma* VmaTree::lower_bound(VirtualAddress addr) const {
+    return tree_.search([addr](const Vma* vma) { return vma->end > addr; });
+}
+
+Vma* VmaTree::insert(VirtualAddress start, VirtualAddress end, uint64 flags) {
+    if (start >= end || !is_page_aligned(start) || !is_page_aligned(end) ||
+        start < USER_SPACE_START || end > USER_SPACE_END) {
+        return nullptr;
+    }
+
+    Vma* after = lower_bound(start);
+    if (after && after->start < end) {
+        return nullptr;
+    }
+
+    Vma* before = after ? prev(after) : last();
+    bool merge_before = before && before->end == start && before->flags == flags;
+    bool merge_after = after && after->start == end && after->flags == flags;
+
+    if (merge_before && merge_after) {
+        VirtualAddress new_end = after->end;
+        erase(after);
+        before->end = new_end;
+        if (Vma* following = next(before)) fix_gap(following);
+        return before;
+    }
+
+    if (merge_before) {
+        before->end = end;
+        if (Vma* following = next(before)) fix_gap(following);
+        return before;
+    }
+
+    if (merge_after) {
+        after->start = start;
+        fix_gap(after);
+        return after;
+    }
+
+    Vma* node = create_node(start, end, flags);
+    link_node(node);
+    return node;
+}
+
+Vma* VmaTree::split(Vma* vma, VirtualAddress addr) {
+    if (addr <= vma->start || addr >= vma->end || !is_page_aligned(addr)) {
+        return nullptr;
+    }
+
+    Vma* upper = create_node(addr, vma->end, vma->flags);
+    vma->end = addr;
+    link_node(upper);
+    return upper;
+}
+
+void VmaTree::remove(VirtualAddress start, VirtualAddress end) {
+    Vma* vma = lower_bound(start);
+    if (vma && vma->start < start) {
+        split(vma, start);
+    }
+
+    while ((vma = lower_bound(start)) && vma->start < end) {
+        if (vma->end > end) {
+            split(vma, end);
+        }
+        erase(vma);
+    }
+}
+
+VirtualAddress VmaTree::find_gap(usize length) const {
+    auto max_gap = [](const Vma* vma) { return vma ? vma->max_gap : 0; };
+
+    // Descend towards the lowest gap that fits
+    Vma* node = tree_.root();
+    while (node) {
+        if (max_gap(Tree::left(node)) >= length) {
+            node = Tree::left(node);
+        } else if (node->gap >= length) {
+            return node->start - node->gap;
+        } else if (max_gap(Tree::right(node)) >= length) {
+            node = Tree::right(node);
+        } else {
+            break;
+        }
+    }
+
+    // Space after the last area
+    Vma* tail = last();
+    VirtualAddress start = tail ? tail->end : USER_SPACE_START;
+    return (USER_SPACE_END - start >= length) ? start : 0;
+}
+
+void VmaTree::clone_from(const VmaTree& other) {
+    clear();
+
+    // Areas arrive in order and never touch, so no merging is needed
+    for (Vma* vma = other.first(); vma; vma = next(vma)) {
+        link_node(create_node(vma->start, vma->end, vma->flags));
+    }
+}
+
+void VmaTree::take_from(VmaTree& other) {
+    clear();
+
+    tree_ = other.tree_;
+    count_ = other.count_;
+    other.tree_ = Tree();
+    other.count_ = 0;
+}
+
+void VmaTree::clear() {
+    tree_.clear([](Vma* vma) { delete vma; });
+    count_ = 0;
+}
+
+Vma* VmaTree::create_node(VirtualAddress start, VirtualAddress end, uint64 flags) {
+    Vma* node = new Vma();
+    node->start = start;
+    node->end = end;
+    node->flags = flags;
+    node->gap = 0;
+    node->max_gap = 0;
+    return node;
+}
+
+void VmaTree::link_node(Vma* node) {
+    tree_.insert(node);
+    count_++;
+
+    fix_gap(node);
+    if (Vma* following = next(node)) fix_gap(following);
+}
+
+void VmaTree::erase(Vma* node) {
+    Vma* following = next(node);
+
+    tree_.erase(node);
+    delete node;
+    count_--;
+
+    // The area after the hole now borders an earlier one
+    if (following) fix_gap(following);
+}
+
+void VmaTree::fix_gap(Vma* vma) {
+    Vma* before = prev(vma);
+    vma->gap = vma->start - (before ? before->end : USER_SPACE_START);
+    tree_.refresh(vma);
+}
+
+} // namespace tiny_os::memory
@@ -0,0 +1,337 @@
+#include <tiny_os/memory/vmalloc.h>
+#include <tiny_os/memory/physical_allocator.h>
+#include <tiny_os/memory/virtual_allocator.h>
+#include <tiny_os/memory/physmap.h>
+#include <tiny_os/arch/x86_64/idt.h>
+#include <tiny_os/drivers/vga.h>
+#include <tiny_os/drivers/serial.h>
+
+namespace tiny_os::memory {
+
+Vmalloc::AddressTree Vmalloc::free_by_address_;
+Vmalloc::SizeTree Vmalloc::free_by_size_;
+Vmalloc::AddressTree Vmalloc::busy_;
+VmapRange* Vmalloc::lazy_ = nullptr;
+usize Vmalloc::lazy_bytes_ = 0;
+VmapRange* Vmalloc::spare_ranges_ = nullptr;
+usize Vmalloc::busy_bytes_ = 0;
+usize Vmalloc::busy_count_ = 0;
+uint64 Vmalloc::purges_ = 0;
+
+namespace {
+
+// Size-ordered candidates tried for an aligned request before falling back
+// to a range large enough for any alignment
+constexpr usize ALIGNED_FIT_PROBES = 8;
+
+constexpr VirtualAddress align_up(VirtualAddress addr, usize align) {
+    return (addr + align - 1) & ~(align - 1);
+}
+
+} // namespace
+
+void Vmalloc::init() {
+    insert_free(new_range(START, END - START));
+
+    drivers::serial_printf("[Vmalloc] Region 0x%lx - 0x%lx\n", START, END);
+}
+
+void* Vmalloc::vmalloc(usize size) {
+    if (size == 0) return nullptr;
+
+    usize length = page_align_up(size);
+    uint64 flags = PageFlags::PRESENT | PageFlags::WRITABLE | VirtualAllocator::nx_flag();
+
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    VmapRange* range = allocate_range(length + GUARD_SIZE, PAGE_SIZE);
+    if (!range) {
+        if (interrupts_enabled) {
+            arch::x86_64::IDT::enable_interrupts();
+        }
+        drivers::serial_printf("[Vmalloc] Out of address space for %lu bytes\n", size);
+        return nullptr;
+    }
+    range->backed = true;
+
+    // Frames come one at a time; runs that happen to be physically
+    // contiguous are mapped with a single map_range
+    VirtualAddress run_virt = range->start;
+    PhysicalAddress run_phys = 0;
+    usize run_length = 0;
+
+    for (usize offset = 0; offset < length; offset += PAGE_SIZE) {
+        PhysicalAddress phys = PhysicalAllocator::allocate_frame();
+
+        if (run_length != 0 && phys == run_phys + run_length) {
+            run_length += PAGE_SIZE;
+            continue;
+        }
+
+        if (run_length != 0) {
+            VirtualAllocator::map_range(run_virt, run_phys, run_length, flags);
+        }
+        run_virt = range->start + offset;
+        run_phys = phys;
+        run_length = PAGE_SIZE;
+    }
+    VirtualAllocator::map_range(run_virt, run_phys, run_length, flags);
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+
+    return reinterpret_cast<void*>(range->start);
+}
+
+void Vmalloc::vfree(void* ptr) {
+    if (!ptr) return;
+
+    VirtualAddress start = reinterpret_cast<VirtualAddress>(ptr);
+
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    VmapRange* range = find_busy(start);
+    if (!range || !range->backed) {
+        if (interrupts_enabled) {
+            arch::x86_64::IDT::enable_interrupts();
+        }
+        drivers::serial_printf("[Vmalloc] vfree of unknown area 0x%lx\n", start);
+        return;
+    }
+
+    // Frames can be reused right away: stale TLB entries only matter to
+    // whoever still touches the freed area. The range itself is not handed
+    // out again before the purge flush.
+    usize length = range->size - GUARD_SIZE;
+    for (VirtualAddress virt = start; virt < start + length; virt += PAGE_SIZE) {
+        PhysicalAllocator::free_frame(VirtualAllocator::virt_to_phys(virt));
+    }
+    VirtualAllocator::unmap_range(start, length, false);
+
+    retire(range);
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+}
+
+VirtualAddress Vmalloc::reserve(usize size, usize align) {
+    if (size == 0 || (align & (align - 1)) != 0) return 0;
+    if (align < PAGE_SIZE) {
+        align = PAGE_SIZE;
+    }
+
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    VmapRange* range = allocate_range(page_align_up(size) + GUARD_SIZE, align);
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+
+    if (!range) {
+        drivers::serial_printf("[Vmalloc] Cannot reserve %lu bytes\n", size);
+        return 0;
+    }
+    return range->start;
+}
+
+void Vmalloc::release(VirtualAddress start) {
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    VmapRange* range = find_busy(start);
+    bool reserved = range && !range->backed;
+    if (reserved) {
+        retire(range);
+    }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+
+    if (!reserved) {
+        drivers::serial_printf("[Vmalloc] release of unknown reservation 0x%lx\n", start);
+    }
+}
+
+void Vmalloc::purge() {
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    if (lazy_) {
+        // Vmalloc mappings are global, so only a global flush drops them
+        VirtualAllocator::flush_tlb_global();
+
+        while (lazy_) {
+            VmapRange* range = lazy_;
+            lazy_ = range->next_lazy;
+            insert_free(range);
+        }
+        lazy_bytes_ = 0;
+        purges_++;
+    }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+}
+
+void Vmalloc::print_stats() {
+    usize free_count = 0;
+    usize free_bytes = 0;
+    usize largest = 0;
+    for (VmapRange* range = free_by_address_.first(); range;
+         range = AddressTree::next(range)) {
+        free_count++;
+        free_bytes += range->size;
+    }
+    if (VmapRange* range = free_by_size_.last()) {
+        largest = range->size;
+    }
+
+    drivers::kprintf("\n=== Vmalloc Statistics ===\n");
+    drivers::kprintf("Areas: %u (%u KB)\n", busy_count_, busy_bytes_ / 1024);
+    drivers::kprintf("Free ranges: %u (%u MB, largest %u MB)\n",
+                    free_count, free_bytes / (1024 * 1024), largest / (1024 * 1024));
+    drivers::kprintf("Lazy: %u KB, purges: %u\n", lazy_bytes_ / 1024, purges_);
+    drivers::kprintf("\n");
+}
+
+VmapRange* Vmalloc::new_range(VirtualAddress start, usize size) {
+    if (!spare_ranges_) {
+        auto* ranges = phys_to_virt<VmapRange>(PhysicalAllocator::allocate_frame());
+        for (usize i = 0; i < PAGE_SIZE / sizeof(VmapRange); i++) {
+            ranges[i].next_lazy = spare_ranges_;
+            spare_ranges_ = &ranges[i];
+        }
+    }
+
+    VmapRange* range = spare_ranges_;
+    spare_ranges_ = range->next_lazy;
+
+    range->start = start;
+    range->size = size;
+    range->backed = false;
+    range->next_lazy = nullptr;
+    return range;
+}
+
+void Vmalloc::delete_range(VmapRange* range) {
+    range->next_lazy = spare_ranges_;
+    spare_ranges_ = range;
+}
+
+VmapRange* Vmalloc::allocate_range(usize size, usize align) {
+    VmapRange* range = find_fit(size, align);
+    if (!range && lazy_) {
+        purge();
+        range = find_fit(size, align);
+    }
+    if (!range) return nullptr;
+
+    remove_free(range);
+
+    VirtualAddress start = align_up(range->start, align);
+    VirtualAddress end = start + size;
+    VirtualAddress range_end = range->start + range->size;
+
+    if (range_end > end) {
+        insert_free(new_range(end, range_end - end));
+    }
+    if (start > range->start) {
+        range->size = start - range->start;
+        insert_free(range);
+        range = new_range(start, size);
+    } else {
+        range->size = size;
+    }
+
+    busy_.insert(range);
+    busy_bytes_ += size;
+    busy_count_++;
+    return range;
+}
+
+VmapRange* Vmalloc::find_fit(usize size, usize align) {
+    // Best fit: the smallest free range that can hold the request
+    VmapRange* range = free_by_size_.search(
+        [size](const VmapRange* r) { return r->size >= size; });
+
+    for (usize probe = 0; range && probe < ALIGNED_FIT_PROBES; probe++) {
+        VirtualAddress start = align_up(range->start, align);
+        if (start - range->start <= range->size - size) {
+            return range;
+        }
+        range = SizeTree::next(range);
+    }
+
+    // Any range this large fits whatever its alignment
+    usize worst = size + align - PAGE_SIZE;
+    return free_by_size_.search(
+        [worst](const VmapRange* r) { return r->size >= worst; });
+}
+
+VmapRange* Vmalloc::find_busy(VirtualAddress start) {
+    VmapRange* range = busy_.search(
+        [start](const VmapRange* r) { return r->start >= start; });
+    return (range && range->start == start) ? range : nullptr;
+}
+
+void Vmalloc::insert_free(VmapRange* range) {
+    VirtualAddress start = range->start;
+    VmapRange* next = free_by_address_.search(
+        [start](const VmapRange* r) { return r->start > start; });
+    VmapRange* prev = next ? AddressTree::prev(next) : free_by_address_.last();
+
+    if (prev && prev->start + prev->size == range->start) {
+        remove_free(prev);
+        prev->size += range->size;
+        delete_range(range);
+        range = prev;
+    }
+    if (next && range->start + range->size == next->start) {
+        remove_free(next);
+        range->size += next->size;
+        delete_range(next);
+    }
+
+    free_by_address_.insert(range);
+    free_by_size_.insert(range);
+}
+
+void Vmalloc::remove_free(VmapRange* range) {
+    free_by_address_.erase(range);
+    free_by_size_.erase(range);
+}
+
+void Vmalloc::retire(VmapRange* range) {
+    busy_.erase(range);
+    busy_bytes_ -= range->size;
+    busy_count_--;
+
+    range->backed = false;
+    range->next_lazy = lazy_;
+    lazy_ = range;
+    lazy_bytes_ += range->size;
+
+    if (lazy_bytes_ >= LAZY_PURGE_THRESHOLD) {
+        purge();
+    }
+}
+
+} // namespace tiny_os::memory
@@ -1,6 +1,9 @@
 #include <tiny_os/process/process.h>
 #include <tiny_os/process/thread.h>
 #include <tiny_os/memory/heap_allocator.h>
+#include <tiny_os/memory/address_space.h>
+#include <tiny_os/memory/slab.h>
+#include <tiny_os/arch/x86_64/idt.h>
 #include <tiny_os/drivers/vga.h>
 #include <tiny_os/drivers/serial.h>
 #include <tiny_os/common/string.h>
@@ -12,6 +15,12 @@ Process* ProcessManager::processes_[MAX_PROCESSES];
 uint32 ProcessManager::next_pid_ = 1;
 Process* ProcessManager::current_process_ = nullptr;
 
+namespace {
+
+memory::ObjectCache<Process> process_cache("process", memory::KmemCache::CACHE_LINE);
+
+} // namespace
+
 const char* process_state_to_string(ProcessState state) {
     switch (state) {
         case ProcessState::CREATED: return "CREATED";
@@ -36,11 +45,110 @@ void ProcessManager::init() {
     drivers::kprintf("[Process] Process manager initialized\n");
 }
 
-Process* ProcessManager::create_kernel_process(const char* name, void (*entry_point)()) {
+Process* ProcessManager::create_kernel_process(const char* name, void (*entry_point)(),
+                                              int priority) {
     drivers::serial_printf("[Process] Creating kernel process: %s\n", name);
 
+    // Kernel processes use kernel page table
+    return create_process(name, entry_point, nullptr, nullptr, priority);
+}
+
+Process* ProcessManager::fork(Process* parent, const char* name, void (*entry_point)()) {
+    if (!parent) return nullptr;
+
+    drivers::serial_printf("[Process] Forking process %d as %s\n", parent->pid, name);
+
+    // The parent must not write to a page between it turning copy-on-write
+    // and the flush of its stale writable TLB entry, nor map or unmap
+    // anything before its areas are copied along with the page table
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    memory::PageTable* page_table;
+    memory::VmaTree vmas;
+    if (parent->page_table) {
+        page_table = memory::AddressSpace::clone(parent->page_table);
+        memory::AddressSpace::flush_tlb(parent->page_table, parent->pcid);
+    } else {
+        page_table = memory::AddressSpace::create();
+    }
+    vmas.clone_from(parent->vmas);
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+
+    int priority = parent->main_thread ? parent->main_thread->priority
+                                       : DEFAULT_THREAD_PRIORITY;
+    Process* child = create_process(name, entry_point, page_table, parent, priority);
+    if (!child) {
+        vmas.clear();
+        memory::AddressSpace::destroy(page_table);
+        return nullptr;
+    }
+
+    // Nothing can fault on the child's pages before it runs
+    child->vmas.take_from(vmas);
+    return child;
+}
+
+VirtualAddress ProcessManager::mmap(Process* process, VirtualAddress addr, usize length,
+                                    uint64 flags) {
+    if (!process || !process->page_table || length == 0) return 0;
+
+    length = page_align_up(length);
+    if (addr == 0) {
+        addr = process->vmas.find_gap(length);
+        if (addr == 0) return 0;
+    }
+
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    bool inserted = process->vmas.insert(addr, addr + length, flags) != nullptr;
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+
+    if (!inserted) {
+        drivers::serial_printf("[Process] mmap of 0x%lx (%lu bytes) failed in process %d\n",
+                              addr, length, process->pid);
+        return 0;
+    }
+
+    return addr;
+}
+
+void ProcessManager::munmap(Process* process, VirtualAddress addr, usize length) {
+    if (!process || !process->page_table || !is_page_aligned(addr)) return;
+
+    VirtualAddress end = addr + page_align_up(length);
+
+    // Fault handling looks at the tree, so keep it consistent with the
+    // page tables while the range goes away
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    process->vmas.remove(addr, end);
+    memory::AddressSpace::unmap_range(process->page_table, process->pcid, addr, end);
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+}
+
+Process* ProcessManager::create_process(const char* name, void (*entry_point)(),
+                                        memory::PageTable* page_table, Process* parent,
+                                        int priority) {
     // Allocate PCB
-    Process* process = new Process();
+    Process* process = process_cache.alloc();
     if (!process) {
         drivers::serial_printf("[Process] Failed to allocate PCB!\n");
         return nullptr;
@@ -49,7 +157,8 @@ Process* ProcessManager::create_kernel_process(const char* name, void (*entry_po
     // Initialize PCB
     process->pid = allocate_pid();
     process->state = ProcessState::CREATED;
-    process->page_table = nullptr;  // Kernel processes use kernel page table
+    process->page_table = page_table;
+    process->pcid = memory::PcidTag{};
 
     // Initialize thread list
     process->threads = new Thread*[INITIAL_THREADS_PER_PROCESS];
@@ -61,7 +170,7 @@ Process* ProcessManager::create_kernel_process(const char* name, void (*entry_po
     process->child_count = 0;
     process->max_children = INITIAL_CHILDREN_PER_PROCESS;
 
-    process->parent = nullptr;
+    process->parent = parent;
     process->exit_code = 0;
 
     // Copy name
@@ -71,12 +180,13 @@ Process* ProcessManager::create_kernel_process(const char* name, void (*entry_po
     process->name[len] = '\0';
 
     // Create main thread
-    process->main_thread = ThreadManager::create_kernel_thread(process, name, entry_point);
+    process->main_thread = ThreadManager::create_kernel_thread(process, name, entry_point,
+                                                               priority);
     if (!process->main_thread) {
         drivers::serial_printf("[Process] Failed to create main thread!\n");
         delete[] process->threads;
         delete[] process->children;
-        delete process;
+        process_cache.free(process);
         return nullptr;
     }
 
@@ -85,6 +195,10 @@ Process* ProcessManager::create_kernel_process(const char* name, void (*entry_po
         processes_[process->pid] = process;
     }
 
+    if (parent) {
+        add_child(parent, process);
+    }
+
     drivers::serial_printf("[Process] Created process %d: %s\n", process->pid, name);
 
     return process;
@@ -137,6 +251,24 @@ void ProcessManager::add_thread(Process* process, Thread* thread) {
     process->threads[process->thread_count++] = thread;
 }
 
+void ProcessManager::add_child(Process* parent, Process* child) {
+    // Check if we need to expand the array
+    if (parent->child_count >= parent->max_children) {
+        usize new_max = parent->max_children * 2;
+        Process** new_children = new Process*[new_max];
+
+        for (usize i = 0; i < parent->child_count; i++) {
+            new_children[i] = parent->children[i];
+        }
+
+        delete[] parent->children;
+        parent->children = new_children;
+        parent->max_children = new_max;
+    }
+
+    parent->children[parent->child_count++] = child;
+}
+
 void ProcessManager::remove_thread(Process* process, Thread* thread) {
     if (!process || !thread) return;
 
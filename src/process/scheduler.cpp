@@ -1,24 +1,46 @@
 #include <tiny_os/process/scheduler.h>
 #include <tiny_os/process/process.h>
 #include <tiny_os/process/context_switch.h>
+#include <tiny_os/memory/virtual_allocator.h>
+#include <tiny_os/memory/physmap.h>
 #include <tiny_os/arch/x86_64/idt.h>
 #include <tiny_os/drivers/vga.h>
 #include <tiny_os/drivers/serial.h>
+#include <tiny_os/drivers/timer.h>
 #include <tiny_os/common/string.h>
 
 namespace tiny_os::process {
 
 // Static member definitions
-Thread* Scheduler::ready_queue_[MAX_READY_THREADS];
-usize Scheduler::ready_queue_head_ = 0;
-usize Scheduler::ready_queue_tail_ = 0;
-usize Scheduler::ready_queue_size_ = 0;
+RunQueue Scheduler::run_queues_[PRIORITY_LEVELS] = {};
+uint32 Scheduler::ready_bitmap_ = 0;
+usize Scheduler::ready_count_ = 0;
 Thread* Scheduler::current_thread_ = nullptr;
 Thread* Scheduler::idle_thread_ = nullptr;
 bool Scheduler::scheduling_enabled_ = false;
 uint64 Scheduler::context_switches_ = 0;
+uint64 Scheduler::preemptions_ = 0;
+uint64 Scheduler::aged_ = 0;
 uint64 Scheduler::idle_time_ = 0;
 
+// Load the address space of `to` if it differs from the one of `from`.
+// Kernel processes all share the kernel page table.
+static void switch_address_space(Process* from, Process* to) {
+    memory::PageTable* from_table = from ? from->page_table : nullptr;
+    memory::PageTable* to_table = to ? to->page_table : nullptr;
+
+    if (from_table == to_table) {
+        return;
+    }
+
+    if (to_table) {
+        memory::VirtualAllocator::switch_address_space(memory::virt_to_phys(to_table),
+                                                       to->pcid);
+    } else {
+        memory::VirtualAllocator::switch_to_kernel();
+    }
+}
+
 // Idle thread function
 static void idle_thread_func() {
     while (true) {
@@ -29,12 +51,17 @@ static void idle_thread_func() {
 void Scheduler::init() {
     drivers::serial_printf("[Scheduler] Initializing scheduler...\n");
 
-    // Clear ready queue
-    ready_queue_head_ = 0;
-    ready_queue_tail_ = 0;
-    ready_queue_size_ = 0;
+    // Clear run queues
+    for (RunQueue& queue : run_queues_) {
+        queue.head = nullptr;
+        queue.tail = nullptr;
+    }
+    ready_bitmap_ = 0;
+    ready_count_ = 0;
 
     context_switches_ = 0;
+    preemptions_ = 0;
+    aged_ = 0;
     idle_time_ = 0;
     scheduling_enabled_ = false;
 
@@ -45,15 +72,14 @@ void Scheduler::init() {
 void Scheduler::start() {
     drivers::serial_printf("[Scheduler] Starting scheduler...\n");
 
-    // Create idle process and thread
-    Process* idle_process = ProcessManager::create_kernel_process("idle", idle_thread_func);
+    // Create idle process and thread at the lowest priority
+    Process* idle_process = ProcessManager::create_kernel_process("idle", idle_thread_func, 0);
     if (!idle_process) {
         drivers::serial_printf("[Scheduler] Failed to create idle process!\n");
         return;
     }
 
     idle_thread_ = idle_process->main_thread;
-    idle_thread_->priority = 0;  // Lowest priority
 
     // Set current thread to idle
     current_thread_ = idle_thread_;
@@ -71,8 +97,8 @@ void Scheduler::start() {
 void Scheduler::add_thread(Thread* thread) {
     if (!thread) return;
 
-    drivers::serial_printf("[Scheduler] Adding thread %d (%s) to ready queue\n",
-                          thread->tid, thread->name);
+    drivers::serial_printf("[Scheduler] Adding thread %d (%s) at priority %d\n",
+                          thread->tid, thread->name, thread->priority);
 
     // Disable interrupts while modifying queue
     bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
@@ -80,28 +106,26 @@ void Scheduler::add_thread(Thread* thread) {
         arch::x86_64::IDT::disable_interrupts();
     }
 
-    if (ready_queue_size_ >= MAX_READY_THREADS) {
-        drivers::serial_printf("[Scheduler] Ready queue full! Cannot add thread %d\n",
-                              thread->tid);
-        if (interrupts_enabled) {
-            arch::x86_64::IDT::enable_interrupts();
-        }
-        return;
-    }
-
-    // Add to tail of queue
-    ready_queue_[ready_queue_tail_] = thread;
-    ready_queue_tail_ = (ready_queue_tail_ + 1) % MAX_READY_THREADS;
-    ready_queue_size_++;
+    bool preempt = false;
+    if (thread != current_thread_ && thread != idle_thread_ && !is_queued(thread)) {
+        thread->effective_priority = thread->priority;
+        thread->state = ThreadState::READY;
+        enqueue(thread);
 
-    thread->state = ThreadState::READY;
+        // The boot thread doubles as the idle thread until kernel_main is
+        // done, so idle is left to the next tick
+        preempt = scheduling_enabled_ && current_thread_ != idle_thread_ &&
+                  outranks_current(static_cast<usize>(thread->effective_priority));
+    }
 
     if (interrupts_enabled) {
         arch::x86_64::IDT::enable_interrupts();
     }
 
-    drivers::serial_printf("[Scheduler] Thread %d added (queue size: %d)\n",
-                          thread->tid, ready_queue_size_);
+    if (preempt) {
+        preemptions_++;
+        schedule();
+    }
 }
 
 void Scheduler::remove_thread(Thread* thread) {
@@ -113,50 +137,103 @@ void Scheduler::remove_thread(Thread* thread) {
         arch::x86_64::IDT::disable_interrupts();
     }
 
-    // Find and remove thread from queue
-    usize index = ready_queue_head_;
-    for (usize i = 0; i < ready_queue_size_; i++) {
-        if (ready_queue_[index] == thread) {
-            // Shift remaining threads
-            for (usize j = i; j < ready_queue_size_ - 1; j++) {
-                usize curr = (ready_queue_head_ + j) % MAX_READY_THREADS;
-                usize next = (ready_queue_head_ + j + 1) % MAX_READY_THREADS;
-                ready_queue_[curr] = ready_queue_[next];
-            }
-
-            ready_queue_size_--;
-            if (ready_queue_size_ > 0) {
-                ready_queue_tail_ = (ready_queue_head_ + ready_queue_size_) % MAX_READY_THREADS;
-            } else {
-                ready_queue_tail_ = ready_queue_head_;
-            }
-
-            drivers::serial_printf("[Scheduler] Removed thread %d from ready queue\n",
-                                  thread->tid);
-            break;
-        }
+    if (is_queued(thread)) {
+        dequeue(thread);
+        drivers::serial_printf("[Scheduler] Removed thread %d from run queue %d\n",
+                              thread->tid, thread->effective_priority);
+    }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+}
+
+void Scheduler::set_priority(Thread* thread, int priority) {
+    if (!thread || thread == idle_thread_) return;
+
+    priority = clamp_priority(priority);
+    drivers::serial_printf("[Scheduler] Thread %d priority %d -> %d\n",
+                          thread->tid, thread->priority, priority);
 
-        index = (index + 1) % MAX_READY_THREADS;
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    // The run queue is picked by effective_priority, so a queued thread
+    // has to leave it before that changes. Any aging boost is dropped.
+    bool queued = thread != current_thread_ && is_queued(thread);
+    if (queued) {
+        dequeue(thread);
+    }
+    thread->priority = priority;
+    thread->effective_priority = priority;
+    if (queued) {
+        enqueue(thread);
+    }
+
+    bool preempt = false;
+    if (scheduling_enabled_ && current_thread_ != idle_thread_ && ready_bitmap_ != 0) {
+        preempt = outranks_current(highest_ready_level());
     }
 
     if (interrupts_enabled) {
         arch::x86_64::IDT::enable_interrupts();
     }
+
+    if (preempt) {
+        preemptions_++;
+        schedule();
+    }
+}
+
+int Scheduler::clamp_priority(int priority) {
+    if (priority < 0) return 0;
+    if (priority >= static_cast<int>(PRIORITY_LEVELS)) return PRIORITY_LEVELS - 1;
+    return priority;
+}
+
+void Scheduler::tick() {
+    if (!scheduling_enabled_ || !current_thread_) return;
+
+    // Called from the timer interrupt, so interrupts are already off
+    Thread* current = current_thread_;
+    current->total_runtime++;
+    if (current == idle_thread_) {
+        idle_time_++;
+    }
+
+    if (drivers::Timer::get_ticks() % AGING_INTERVAL == 0) {
+        age_ready_threads();
+    }
+
+    bool expired = current->time_slice_remaining <= 1;
+    if (!expired) {
+        current->time_slice_remaining--;
+    }
+
+    if (ready_bitmap_ != 0 && (expired || outranks_current(highest_ready_level()))) {
+        if (!expired) {
+            preemptions_++;
+        }
+        schedule();
+    }
 }
 
 void Scheduler::schedule() {
     if (!scheduling_enabled_) return;
 
-    // Get next thread to run
-    Thread* next = get_next_thread();
-
-    // If next is same as current, nothing to do
-    if (next == current_thread_) {
-        return;
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
     }
 
-    // Switch to next thread
-    switch_to(next);
+    // Get next thread to run; switch_to does nothing if it is the current one
+    switch_to(get_next_thread());
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
 }
 
 void Scheduler::yield() {
@@ -174,8 +251,7 @@ void Scheduler::block_current() {
     drivers::serial_printf("[Scheduler] Blocking thread %d\n", current_thread_->tid);
 
     current_thread_->state = ThreadState::BLOCKED;
-    remove_thread(current_thread_);
-    yield();
+    schedule();
 }
 
 void Scheduler::unblock_thread(Thread* thread) {
@@ -183,7 +259,6 @@ void Scheduler::unblock_thread(Thread* thread) {
 
     drivers::serial_printf("[Scheduler] Unblocking thread %d\n", thread->tid);
 
-    thread->state = ThreadState::READY;
     add_thread(thread);
 }
 
@@ -195,36 +270,122 @@ void Scheduler::print_stats() {
     drivers::kprintf("\n=== Scheduler Statistics ===\n");
     drivers::kprintf("Context switches: %d\n", context_switches_);
     drivers::kprintf("Idle time: %d ticks\n", idle_time_);
-    drivers::kprintf("Ready queue size: %d\n", ready_queue_size_);
+    drivers::kprintf("Preemptions: %d\n", preemptions_);
+    drivers::kprintf("Aged threads: %d\n", aged_);
+    drivers::kprintf("Ready threads: %d (levels 0x%x)\n", ready_count_, ready_bitmap_);
     drivers::kprintf("Current thread: %d (%s)\n",
                     current_thread_ ? current_thread_->tid : 0,
                     current_thread_ ? current_thread_->name : "none");
     drivers::kprintf("\n");
 }
 
-Thread* Scheduler::get_next_thread() {
-    // If ready queue is empty, return idle thread
-    if (ready_queue_size_ == 0) {
-        return idle_thread_;
+void Scheduler::enqueue(Thread* thread) {
+    thread->effective_priority = clamp_priority(thread->effective_priority);
+
+    usize level = static_cast<usize>(thread->effective_priority);
+    RunQueue& queue = run_queues_[level];
+
+    thread->next_ready = nullptr;
+    thread->prev_ready = queue.tail;
+    if (queue.tail) {
+        queue.tail->next_ready = thread;
+    } else {
+        queue.head = thread;
     }
+    queue.tail = thread;
+
+    thread->ready_since = drivers::Timer::get_ticks();
+    ready_bitmap_ |= 1U << level;
+    ready_count_++;
+}
+
+void Scheduler::dequeue(Thread* thread) {
+    usize level = static_cast<usize>(thread->effective_priority);
+    RunQueue& queue = run_queues_[level];
 
-    // Get thread from head of queue
-    Thread* next = ready_queue_[ready_queue_head_];
-    ready_queue_head_ = (ready_queue_head_ + 1) % MAX_READY_THREADS;
-    ready_queue_size_--;
+    if (thread->prev_ready) {
+        thread->prev_ready->next_ready = thread->next_ready;
+    } else {
+        queue.head = thread->next_ready;
+    }
+    if (thread->next_ready) {
+        thread->next_ready->prev_ready = thread->prev_ready;
+    } else {
+        queue.tail = thread->prev_ready;
+    }
+    thread->next_ready = nullptr;
+    thread->prev_ready = nullptr;
 
-    // If current thread is still ready, add it back to queue
+    if (!queue.head) {
+        ready_bitmap_ &= ~(1U << level);
+    }
+    ready_count_--;
+}
+
+bool Scheduler::is_queued(Thread* thread) {
+    return thread->prev_ready ||
+           run_queues_[static_cast<usize>(thread->effective_priority)].head == thread;
+}
+
+usize Scheduler::highest_ready_level() {
+    return 31 - __builtin_clz(ready_bitmap_);
+}
+
+bool Scheduler::outranks_current(usize level) {
+    return current_thread_ == idle_thread_ ||
+           level > static_cast<usize>(current_thread_->effective_priority);
+}
+
+void Scheduler::age_ready_threads() {
+    uint64 now = drivers::Timer::get_ticks();
+
+    // Each queue's head has waited longest there; the top level has
+    // nowhere to go
+    uint32 levels = ready_bitmap_ & ~(1U << (PRIORITY_LEVELS - 1));
+    while (levels) {
+        usize level = __builtin_ctz(levels);
+        levels &= levels - 1;
+
+        Thread* thread = run_queues_[level].head;
+        if (now - thread->ready_since < STARVATION_TICKS) continue;
+
+        dequeue(thread);
+        thread->effective_priority = static_cast<int>(level) + 1;
+        enqueue(thread);
+        aged_++;
+    }
+}
+
+Thread* Scheduler::get_next_thread() {
+    // A thread still running goes to the back of its own priority, its
+    // aging boost spent
     if (current_thread_ &&
         current_thread_->state == ThreadState::RUNNING &&
         current_thread_ != idle_thread_) {
-        add_thread(current_thread_);
+        current_thread_->state = ThreadState::READY;
+        current_thread_->effective_priority = current_thread_->priority;
+        enqueue(current_thread_);
+    }
+
+    // If the run queues are empty, return idle thread
+    if (ready_bitmap_ == 0) {
+        return idle_thread_;
     }
 
+    Thread* next = run_queues_[highest_ready_level()].head;
+    dequeue(next);
     return next;
 }
 
 void Scheduler::switch_to(Thread* next_thread) {
-    if (!next_thread || next_thread == current_thread_) {
+    if (!next_thread) {
+        return;
+    }
+
+    // Picked again: keep running with a fresh slice
+    if (next_thread == current_thread_) {
+        next_thread->state = ThreadState::RUNNING;
+        next_thread->time_slice_remaining = TIME_SLICE;
         return;
     }
 
@@ -242,18 +403,15 @@ void Scheduler::switch_to(Thread* next_thread) {
     }
 
     next_thread->state = ThreadState::RUNNING;
+    next_thread->time_slice_remaining = TIME_SLICE;
     current_thread_ = next_thread;
     ThreadManager::set_current(next_thread);
 
     context_switches_++;
 
-    // Track idle time
-    if (next_thread == idle_thread_) {
-        idle_time_++;
-    }
-
     // Perform context switch
     if (old_thread) {
+        switch_address_space(old_thread->process, next_thread->process);
         context_switch(&old_thread->cpu_state, next_thread->cpu_state);
     } else {
         // First time - just load new context
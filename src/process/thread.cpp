@@ -1,8 +1,10 @@
 #include <tiny_os/process/thread.h>
 #include <tiny_os/process/process.h>
 #include <tiny_os/process/scheduler.h>
-#include <tiny_os/memory/heap_allocator.h>
+#include <tiny_os/memory/kernel_stack.h>
+#include <tiny_os/memory/slab.h>
 #include <tiny_os/memory/virtual_allocator.h>
+#include <tiny_os/arch/x86_64/idt.h>
 #include <tiny_os/drivers/vga.h>
 #include <tiny_os/drivers/serial.h>
 #include <tiny_os/common/string.h>
@@ -12,6 +14,14 @@ namespace tiny_os::process {
 // Static member definitions
 uint32 ThreadManager::next_tid_ = 1;
 Thread* ThreadManager::current_thread_ = nullptr;
+Thread* ThreadManager::zombies_ = nullptr;
+
+namespace {
+
+// TCBs are written on every context switch; keep each on its own lines
+memory::ObjectCache<Thread> thread_cache("thread", memory::KmemCache::CACHE_LINE);
+
+} // namespace
 
 const char* thread_state_to_string(ThreadState state) {
     switch (state) {
@@ -26,16 +36,20 @@ const char* thread_state_to_string(ThreadState state) {
 
 void ThreadManager::init() {
     drivers::serial_printf("[Thread] Initializing thread manager...\n");
+    memory::KernelStack::init();
     drivers::serial_printf("[Thread] Thread manager initialized\n");
     drivers::kprintf("[Thread] Thread manager initialized\n");
 }
 
 Thread* ThreadManager::create_kernel_thread(Process* process, const char* name,
-                                           void (*entry_point)()) {
+                                           void (*entry_point)(), int priority) {
     drivers::serial_printf("[Thread] Creating kernel thread: %s\n", name);
 
+    // Recycle the stacks of threads that exited since
+    reap();
+
     // Allocate TCB
-    Thread* thread = new Thread();
+    Thread* thread = thread_cache.alloc();
     if (!thread) {
         drivers::serial_printf("[Thread] Failed to allocate TCB!\n");
         return nullptr;
@@ -46,21 +60,21 @@ Thread* ThreadManager::create_kernel_thread(Process* process, const char* name,
     thread->process = process;
     thread->state = ThreadState::CREATED;
 
-    // Allocate kernel stack
-    thread->stack_size = DEFAULT_STACK_SIZE;
-    void* stack_memory = memory::HeapAllocator::kmalloc(thread->stack_size);
-    if (!stack_memory) {
+    // Allocate kernel stack; a guard page below it catches an overflow
+    thread->stack_size = memory::KernelStack::STACK_SIZE;
+    thread->kernel_stack_bottom = memory::KernelStack::allocate();
+    if (!thread->kernel_stack_bottom) {
         drivers::serial_printf("[Thread] Failed to allocate stack!\n");
-        delete thread;
+        thread_cache.free(thread);
         return nullptr;
     }
 
-    thread->kernel_stack_bottom = reinterpret_cast<VirtualAddress>(stack_memory);
     thread->kernel_stack_top = thread->kernel_stack_bottom + thread->stack_size;
 
     // Initialize scheduling fields
-    thread->priority = DEFAULT_PRIORITY;
-    thread->time_slice_remaining = DEFAULT_TIME_SLICE;
+    thread->priority = Scheduler::clamp_priority(priority);
+    thread->effective_priority = thread->priority;
+    thread->time_slice_remaining = Scheduler::TIME_SLICE;
     thread->total_runtime = 0;
 
     // Copy name
@@ -100,6 +114,21 @@ void ThreadManager::set_current(Thread* thread) {
     // Remove from scheduler
     Scheduler::remove_thread(current_thread_);
 
+    // We are still running on our stack: leave it to whoever reaps next
+    reap();
+
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    current_thread_->next_zombie = zombies_;
+    zombies_ = current_thread_;
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+
     // Yield to next thread (never returns)
     Scheduler::yield();
 
@@ -109,6 +138,41 @@ void ThreadManager::set_current(Thread* thread) {
     }
 }
 
+void ThreadManager::reap() {
+    bool interrupts_enabled = arch::x86_64::IDT::are_interrupts_enabled();
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::disable_interrupts();
+    }
+
+    // Take the list; the current thread is the only one that can still be
+    // on its own stack
+    Thread* list = zombies_;
+    zombies_ = nullptr;
+
+    while (list) {
+        Thread* thread = list;
+        list = thread->next_zombie;
+
+        if (thread == current_thread_) {
+            thread->next_zombie = zombies_;
+            zombies_ = thread;
+            continue;
+        }
+
+        ProcessManager::remove_thread(thread->process, thread);
+        if (thread->process->main_thread == thread) {
+            thread->process->main_thread = nullptr;
+        }
+
+        memory::KernelStack::free(thread->kernel_stack_bottom);
+        thread_cache.free(thread);
+    }
+
+    if (interrupts_enabled) {
+        arch::x86_64::IDT::enable_interrupts();
+    }
+}
+
 void ThreadManager::yield() {
     Scheduler::yield();
 }